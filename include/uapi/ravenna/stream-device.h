@@ -65,6 +65,11 @@ struct ra_sd_rtcp_tx_data {
 	} primary, secondary;
 };
 
+/*
+ * The driver caches the RTCP data of all streams. If no data has been read
+ * for the stream yet, the call waits for at most timeout_ms. On return,
+ * timeout_ms holds the time spent waiting.
+ */
 struct ra_sd_read_rtcp_rx_stat_cmd {
 	__u32 index;
 	__u32 timeout_ms;
@@ -77,6 +82,269 @@ struct ra_sd_read_rtcp_tx_stat_cmd {
 	struct ra_sd_rtcp_tx_data data;
 };
 
+/* Bulk RTCP statistics */
+
+#define RA_SD_RTCP_STATS_MAX_RECORDS	1024
+
+/* Report all streams, in index order, instead of the given indices */
+#define RA_SD_RTCP_STATS_ALL		(1 << 0)
+
+enum {
+	RA_SD_RTCP_STATUS_OK		= 0,
+	/* The page of the stream has not been read yet */
+	RA_SD_RTCP_STATUS_NO_DATA	= 1,
+	/* There is no stream with the given index */
+	RA_SD_RTCP_STATUS_NO_STREAM	= 2,
+};
+
+struct ra_sd_rtcp_rx_record {
+	__u32 index;
+
+	/* Filled in by the driver: RA_SD_RTCP_STATUS_... */
+	__u32 status;
+
+	/* Filled in by the driver: time since the data was read, saturated */
+	__u32 age_us;
+
+	__u32 reserved_0;
+
+	struct ra_sd_rtcp_rx_data data;
+};
+
+struct ra_sd_rtcp_tx_record {
+	__u32 index;
+	__u32 status;
+	__u32 age_us;
+	__u32 reserved_0;
+
+	struct ra_sd_rtcp_tx_data data;
+};
+
+struct ra_sd_read_rtcp_stats_cmd {
+	__u32 version;
+
+	/* RA_SD_RTCP_STATS_... */
+	__u32 flags;
+
+	/*
+	 * Number of entries in records, at most RA_SD_RTCP_STATS_MAX_RECORDS.
+	 * Filled in by the driver with the number of records written.
+	 */
+	__u32 num_records;
+
+	/*
+	 * Filled in by the driver with the number of existing streams if
+	 * RA_SD_RTCP_STATS_ALL is set, which may exceed num_records.
+	 */
+	__u32 num_streams;
+
+	/*
+	 * Userspace pointer to an array of struct ra_sd_rtcp_rx_record or
+	 * struct ra_sd_rtcp_tx_record. The index of each record is read
+	 * unless RA_SD_RTCP_STATS_ALL is set.
+	 */
+	__u64 records;
+};
+
+/*
+ * Shared statistics area, mapped read-only with mmap() at offset 0. It
+ * starts with struct ra_sd_stats_header, followed by one RTCP record per RX
+ * and TX stream table entry at the offsets given in the header.
+ *
+ * Each record, and the counters in the header, are guarded by a sequence
+ * number which is odd while the kernel updates them. Readers retry if the
+ * number was odd or changed while they copied the data:
+ *
+ *	do {
+ *		seq = READ_ONCE(r->seq);
+ *		rmb();
+ *		copy = *r;
+ *		rmb();
+ *	} while ((seq & 1) || seq != READ_ONCE(r->seq));
+ */
+
+#define RA_SD_STATS_VERSION	0
+
+struct ra_sd_stats_header {
+	/* RA_SD_STATS_VERSION */
+	__u32 version;
+
+	/* Size of the whole area in bytes */
+	__u32 size;
+
+	__u32 num_rx_records;
+	__u32 rx_record_size;
+	__u32 rx_offset;
+
+	__u32 num_tx_records;
+	__u32 tx_record_size;
+	__u32 tx_offset;
+
+	/* Guards the fields below */
+	__u32 seq;
+
+	/* Raw decoder counters of the hardware */
+	__u32 rx_dec_drop;
+	__u32 rx_dec_fifo_ovr;
+
+	__u32 reserved_0;
+
+	/* CLOCK_MONOTONIC time of the last counter update */
+	__u64 counters_timestamp_ns;
+};
+
+struct ra_sd_stats_rtcp_rx {
+	__u32 seq;
+	__u32 reserved_0;
+
+	/* CLOCK_MONOTONIC time the page was read, 0 if there is no data */
+	__u64 timestamp_ns;
+
+	struct ra_sd_rtcp_rx_data data;
+
+	__u32 reserved_1;
+};
+
+struct ra_sd_stats_rtcp_tx {
+	__u32 seq;
+	__u32 reserved_0;
+	__u64 timestamp_ns;
+
+	struct ra_sd_rtcp_tx_data data;
+
+	__u32 reserved_1;
+};
+
+/*
+ * Stream health events, read() from the character device in units of
+ * struct ra_sd_event. Each file descriptor sees the events which occur after
+ * it was opened. poll() reports EPOLLIN while events are pending.
+ */
+
+enum {
+	/* dev_state of an RX stream changed, RA_SD_STATE_... */
+	RA_SD_EVENT_RX_STATE		= 0,
+	/* The playing flag of an RX interface changed */
+	RA_SD_EVENT_RX_PLAYING		= 1,
+	/* The error flag of an RX interface changed */
+	RA_SD_EVENT_RX_ERROR		= 2,
+	/* The timeout counter of an RX interface changed */
+	RA_SD_EVENT_RX_TIMEOUT		= 3,
+	/* Late packets since the last read reached the threshold */
+	RA_SD_EVENT_RX_LATE_PKTS	= 4,
+	/* Early packets since the last read reached the threshold */
+	RA_SD_EVENT_RX_EARLY_PKTS	= 5,
+	/* An active TX interface stopped (value 1) or resumed (value 0) sending */
+	RA_SD_EVENT_TX_STALLED		= 6,
+	/* The reader fell behind, value holds the number of lost events */
+	RA_SD_EVENT_OVERFLOW		= 7,
+};
+
+enum {
+	RA_SD_INTERFACE_PRIMARY		= 0,
+	RA_SD_INTERFACE_SECONDARY	= 1,
+};
+
+struct ra_sd_event {
+	/* CLOCK_MONOTONIC time of the RTCP read which raised the event */
+	__u64 timestamp_ns;
+
+	/* RA_SD_EVENT_... */
+	__u32 type;
+
+	/* Stream index */
+	__u32 index;
+
+	/* RA_SD_DIRECTION_... */
+	__u8 direction;
+
+	/* RA_SD_INTERFACE_..., if applicable */
+	__u8 interface;
+
+	__u8 reserved_0[2];
+
+	/* New value and, for changes, the previous one */
+	__u32 value;
+	__u32 old_value;
+
+	__u32 reserved_1;
+};
+
+/* Requires CAP_NET_ADMIN */
+struct ra_sd_set_event_config_cmd {
+	__u32 version;
+
+	/* Late and early packets per RTCP read that raise an event, 0 to disable */
+	__u32 late_pkts_threshold;
+	__u32 early_pkts_threshold;
+};
+
+/*
+ * RTCP history. The driver keeps a rolling window of buckets per RX stream,
+ * each of which aggregates the RTCP reads that fall into it. By default, the
+ * window covers 60 buckets of 1000 ms. Changing the window geometry requires
+ * CAP_NET_ADMIN.
+ */
+
+#define RA_SD_HISTORY_MAX_BUCKETS	3600
+#define RA_SD_HISTORY_MIN_BUCKET_MS	100
+#define RA_SD_HISTORY_MAX_BUCKET_MS	3600000
+
+struct ra_sd_history_stat {
+	__s32 min;
+	__s32 max;
+	__s32 mean;
+	__u32 reserved_0;
+};
+
+struct ra_sd_rx_history_interface {
+	struct ra_sd_history_stat estimated_jitter;
+	struct ra_sd_history_stat peak_jitter;
+	struct ra_sd_history_stat buffer_margin_min;
+	struct ra_sd_history_stat buffer_margin_max;
+
+	/* Packets counted within the window */
+	__u32 late_pkts;
+	__u32 early_pkts;
+	__u32 misordered_pkts;
+	__u32 reserved_0;
+};
+
+struct ra_sd_rx_history {
+	/* Number of RTCP reads aggregated, the statistics are 0 if none */
+	__u32 num_samples;
+
+	/* Time covered by the aggregated buckets */
+	__u32 duration_ms;
+
+	struct ra_sd_history_stat path_differential;
+	struct ra_sd_rx_history_interface primary, secondary;
+};
+
+struct ra_sd_read_rx_history_cmd {
+	__u32 version;
+	__u32 index;
+
+	/* Number of most recent buckets to aggregate, 0 for the whole window */
+	__u32 num_buckets;
+
+	/* Filled in by the driver: length of a bucket */
+	__u32 bucket_ms;
+
+	/* Filled in by the driver */
+	struct ra_sd_rx_history history;
+};
+
+struct ra_sd_set_history_config_cmd {
+	__u32 version;
+
+	/* Number of buckets per stream, 0 to disable the history */
+	__u32 num_buckets;
+
+	/* Length of a bucket */
+	__u32 bucket_ms;
+};
+
 /* RX streams */
 
 struct ra_sd_rx_stream {
@@ -182,17 +450,363 @@ struct ra_sd_delete_tx_stream_cmd {
 	__u32 index;
 };
 
+/* Batched stream configuration */
+
+enum {
+	RA_SD_BATCH_OP_ADD_RX_STREAM	= 0,
+	RA_SD_BATCH_OP_UPDATE_RX_STREAM	= 1,
+	RA_SD_BATCH_OP_DELETE_RX_STREAM	= 2,
+	RA_SD_BATCH_OP_ADD_TX_STREAM	= 3,
+	RA_SD_BATCH_OP_UPDATE_TX_STREAM	= 4,
+	RA_SD_BATCH_OP_DELETE_TX_STREAM	= 5,
+};
+
+#define RA_SD_BATCH_MAX_OPS	1024
+
+struct ra_sd_batch_op {
+	/* RA_SD_BATCH_OP_... */
+	__u32 op;
+
+	/*
+	 * Stream index for update and delete operations. Filled in by the
+	 * driver with the allocated index for add operations.
+	 */
+	__u32 index;
+
+	/* Filled in by the driver: 0 on success or a negative errno */
+	__s32 result;
+
+	__u32 reserved_0;
+
+	union {
+		struct ra_sd_rx_stream rx;
+		struct ra_sd_tx_stream tx;
+	};
+};
+
+struct ra_sd_batch_cmd {
+	__u32 version;
+
+	/* Number of entries in ops, at most RA_SD_BATCH_MAX_OPS */
+	__u32 num_ops;
+
+	/* Userspace pointer to an array of struct ra_sd_batch_op */
+	__u64 ops;
+};
+
+/*
+ * Staged stream configuration. Operations are queued per file descriptor with
+ * RA_SD_STAGE and applied atomically with RA_SD_COMMIT. Updates and deletes
+ * may only refer to streams which exist before the commit, and each of them
+ * only once per commit. If the commit fails, nothing is applied and the
+ * staged operations are kept until RA_SD_DISCARD is issued.
+ */
+
+#define RA_SD_STAGE_MAX_OPS	RA_SD_BATCH_MAX_OPS
+
+struct ra_sd_stage_cmd {
+	__u32 version;
+	__u32 reserved_0;
+
+	/* The result field is ignored */
+	struct ra_sd_batch_op op;
+};
+
+struct ra_sd_commit_cmd {
+	__u32 version;
+
+	/*
+	 * Number of entries in indices. If indices is non-zero, it must be
+	 * large enough to hold one entry per staged operation.
+	 */
+	__u32 num_indices;
+
+	/*
+	 * Userspace pointer to an array of __u32, receives the stream index of
+	 * each staged operation, in staging order.
+	 */
+	__u64 indices;
+
+	/* Filled in by the driver: position of the failing operation, or -1 */
+	__s32 failed_op;
+
+	__u32 reserved_0;
+};
+
+struct ra_sd_discard_cmd {
+	__u32 version;
+};
+
+/* Stream activation */
+
+enum {
+	RA_SD_DIRECTION_RX	= 0,
+	RA_SD_DIRECTION_TX	= 1,
+};
+
+#define RA_SD_SET_ACTIVE_MAX_ENTRIES	1024
+
+struct ra_sd_stream_active {
+	/* RA_SD_DIRECTION_... */
+	__u8 direction;
+	__bool active;
+	__u8 reserved_0[2];
+	__u32 index;
+};
+
+struct ra_sd_set_active_cmd {
+	__u32 version;
+
+	/* Number of entries, at most RA_SD_SET_ACTIVE_MAX_ENTRIES */
+	__u32 num_entries;
+
+	/* Userspace pointer to an array of struct ra_sd_stream_active */
+	__u64 entries;
+};
+
+/* Channel to track routing */
+
+#define RA_SD_SET_ROUTES_MAX_ENTRIES	4096
+
+struct ra_sd_route {
+	/* RA_SD_DIRECTION_... */
+	__u8 direction;
+	__u8 reserved_0;
+
+	/* Channel of the stream to route */
+	__u16 channel;
+
+	/* Stream index */
+	__u32 index;
+
+	/* Put RA_NULL_TRACK to route the channel nowhere */
+	__s16 track;
+	__u8 reserved_1[2];
+};
+
+struct ra_sd_set_routes_cmd {
+	__u32 version;
+
+	/* Number of entries, at most RA_SD_SET_ROUTES_MAX_ENTRIES */
+	__u32 num_routes;
+
+	/* Userspace pointer to an array of struct ra_sd_route */
+	__u64 routes;
+};
+
+/* Stream enumeration and lookup */
+
+#define RA_SD_LIST_MAX_RECORDS		1024
+
+struct ra_sd_rx_stream_record {
+	__u32 index;
+
+	/* PID of the creator, in the PID namespace of the caller */
+	__s32 owner_pid;
+
+	struct ra_sd_rx_stream_interface primary, secondary;
+
+	__u16 num_channels;
+	__u8 codec;
+	__bool active;
+
+	/* First track table entry of the stream */
+	__s32 trtb_index;
+};
+
+struct ra_sd_tx_stream_record {
+	__u32 index;
+	__s32 owner_pid;
+
+	struct ra_sd_tx_stream_interface primary, secondary;
+
+	__u16 num_channels;
+	__u8 codec;
+	__bool active;
+
+	__s32 trtb_index;
+};
+
+struct ra_sd_list_streams_cmd {
+	__u32 version;
+
+	/*
+	 * Number of entries in records, at most RA_SD_LIST_MAX_RECORDS.
+	 * Filled in by the driver with the number of records written.
+	 */
+	__u32 num_records;
+
+	/* Filled in by the driver: number of existing streams */
+	__u32 num_streams;
+
+	__u32 reserved_0;
+
+	/*
+	 * Userspace pointer to an array of struct ra_sd_rx_stream_record or
+	 * struct ra_sd_tx_stream_record, filled in index order.
+	 */
+	__u64 records;
+};
+
+struct ra_sd_find_rx_stream_cmd {
+	__u32 version;
+
+	/* Matched against both the primary and the secondary interface */
+	__be32 destination_ip;
+	__be16 destination_port;
+	__u8 reserved_0[2];
+
+	/* Filled in by the driver: lowest matching index */
+	__u32 index;
+
+	/* Filled in by the driver: number of matching streams */
+	__u32 num_matches;
+};
+
+/*
+ * TX bandwidth admission control. The wire bandwidth of a TX stream is
+ * derived from the sample rate, the number of samples per packet and the
+ * frame size including the Ethernet, VLAN, IP, UDP and RTP overhead, and is
+ * accounted on each interface the stream uses, whether it is active or not.
+ * Adding or updating a stream fails with -EDQUOT if it would exceed the
+ * budget of an interface. Setting the configuration requires
+ * CAP_NET_ADMIN.
+ */
+struct ra_sd_set_tx_bandwidth_config_cmd {
+	__u32 version;
+
+	/* Media clock rate in Hz, 48000 by default */
+	__u32 sample_rate;
+
+	/* In bit/s, 0 for no limit, which is the default */
+	__u64 primary_budget_bps;
+	__u64 secondary_budget_bps;
+};
+
+struct ra_sd_read_tx_bandwidth_cmd {
+	__u32 version;
+
+	/* Filled in by the driver */
+	__u32 sample_rate;
+
+	struct ra_sd_tx_bandwidth {
+		__u64 budget_bps;
+		__u64 used_bps;
+	} primary, secondary;
+};
+
+/* Track table defragmentation */
+
+#define RA_SD_DEFRAG_RX		(1 << 0)
+#define RA_SD_DEFRAG_TX		(1 << 1)
+
+struct ra_sd_defrag_cmd {
+	__u32 version;
+
+	/* RA_SD_DEFRAG_... */
+	__u32 flags;
+};
+
+/*
+ * Stream handover between processes. Streams are owned by the file
+ * descriptor which created them and are deleted when it is closed. Detached
+ * streams have no owner and keep running until they are adopted by token.
+ * Tokens are generated by the driver, one per file descriptor.
+ */
+
+/*
+ * Token of the streams which were found running in the hardware when the
+ * driver was loaded with the lawo,adopt-streams DT property set. Adopting
+ * them requires CAP_NET_ADMIN.
+ */
+#define RA_SD_TOKEN_ADOPTED	((__u64)-1)
+
+/* Do not detach right away, but when the file descriptor is closed */
+#define RA_SD_DETACH_ON_CLOSE	(1 << 0)
+/* Delete the streams on close again, which is the default */
+#define RA_SD_DETACH_CANCEL	(1 << 1)
+
+struct ra_sd_detach_streams_cmd {
+	__u32 version;
+
+	/* RA_SD_DETACH_... */
+	__u32 flags;
+
+	/*
+	 * Filled in by the driver: key for adopting the streams. It is the
+	 * same for all calls on a file descriptor.
+	 */
+	__u64 token;
+
+	/* Filled in by the driver: number of streams detached right away */
+	__u32 num_rx_streams;
+	__u32 num_tx_streams;
+};
+
+/* Take over the streams of the open file descriptor fd instead */
+#define RA_SD_ADOPT_FROM_FD	(1 << 0)
+
+struct ra_sd_adopt_streams_cmd {
+	__u32 version;
+
+	/* RA_SD_ADOPT_... */
+	__u32 flags;
+
+	/* Token the streams were detached with */
+	__u64 token;
+
+	/* File descriptor of this device, e.g. received over a UNIX socket */
+	__s32 fd;
+	__u32 reserved_0;
+
+	/* Filled in by the driver: number of streams adopted */
+	__u32 num_rx_streams;
+	__u32 num_tx_streams;
+};
+
+/*
+ * io_uring passthrough (IORING_OP_URING_CMD). The command opcode is one of
+ * the ioctl numbers below, and the command area of the SQE holds this
+ * structure. The result of the command is reported in the CQE.
+ */
+struct ra_sd_uring_cmd {
+	/* Userspace pointer to the argument structure of the ioctl */
+	__u64 arg;
+	__u64 reserved_0;
+};
+
 #define RA_SD_READ_INFO		_IOWR('r', 0x00, struct ra_sd_read_info_cmd)
 
 #define RA_SD_READ_RTCP_RX_STAT	_IOWR('r', 0x10, struct ra_sd_read_rtcp_rx_stat_cmd)
 #define RA_SD_READ_RTCP_TX_STAT	_IOWR('r', 0x11, struct ra_sd_read_rtcp_tx_stat_cmd)
+#define RA_SD_READ_RTCP_RX_STATS	_IOWR('r', 0x12, struct ra_sd_read_rtcp_stats_cmd)
+#define RA_SD_READ_RTCP_TX_STATS	_IOWR('r', 0x13, struct ra_sd_read_rtcp_stats_cmd)
+#define RA_SD_READ_RX_HISTORY	_IOWR('r', 0x14, struct ra_sd_read_rx_history_cmd)
+#define RA_SD_SET_HISTORY_CONFIG	_IOW('r', 0x15, struct ra_sd_set_history_config_cmd)
 
 #define RA_SD_ADD_TX_STREAM	_IOW('r', 0x20, struct ra_sd_add_tx_stream_cmd)
 #define RA_SD_UPDATE_TX_STREAM	_IOW('r', 0x21, struct ra_sd_update_tx_stream_cmd)
 #define RA_SD_DELETE_TX_STREAM	_IOW('r', 0x22, struct ra_sd_delete_tx_stream_cmd)
+#define RA_SD_SET_TX_BANDWIDTH_CONFIG	_IOW('r', 0x23, struct ra_sd_set_tx_bandwidth_config_cmd)
+#define RA_SD_READ_TX_BANDWIDTH	_IOWR('r', 0x24, struct ra_sd_read_tx_bandwidth_cmd)
 
 #define RA_SD_ADD_RX_STREAM	_IOW('r', 0x30, struct ra_sd_add_rx_stream_cmd)
 #define RA_SD_UPDATE_RX_STREAM	_IOW('r', 0x31, struct ra_sd_update_rx_stream_cmd)
 #define RA_SD_DELETE_RX_STREAM	_IOW('r', 0x32, struct ra_sd_delete_rx_stream_cmd)
 
+#define RA_SD_BATCH		_IOW('r', 0x40, struct ra_sd_batch_cmd)
+#define RA_SD_STAGE		_IOW('r', 0x41, struct ra_sd_stage_cmd)
+#define RA_SD_COMMIT		_IOWR('r', 0x42, struct ra_sd_commit_cmd)
+#define RA_SD_DISCARD		_IOW('r', 0x43, struct ra_sd_discard_cmd)
+#define RA_SD_SET_ACTIVE	_IOW('r', 0x44, struct ra_sd_set_active_cmd)
+#define RA_SD_SET_ROUTES	_IOW('r', 0x45, struct ra_sd_set_routes_cmd)
+#define RA_SD_DEFRAG		_IOW('r', 0x46, struct ra_sd_defrag_cmd)
+#define RA_SD_LIST_RX_STREAMS	_IOWR('r', 0x47, struct ra_sd_list_streams_cmd)
+#define RA_SD_LIST_TX_STREAMS	_IOWR('r', 0x48, struct ra_sd_list_streams_cmd)
+#define RA_SD_FIND_RX_STREAM	_IOWR('r', 0x49, struct ra_sd_find_rx_stream_cmd)
+#define RA_SD_DETACH_STREAMS	_IOWR('r', 0x4a, struct ra_sd_detach_streams_cmd)
+#define RA_SD_ADOPT_STREAMS	_IOWR('r', 0x4b, struct ra_sd_adopt_streams_cmd)
+
+#define RA_SD_SET_EVENT_CONFIG	_IOW('r', 0x50, struct ra_sd_set_event_config_cmd)
+
 #endif /* _UAPI_RAVENNA_STREAM_DEVICE_H */
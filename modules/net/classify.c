@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/netdevice.h>
+#include <linux/ptp_classify.h>
+#include <linux/udp.h>
+
+#include "main.h"
+
+/*
+ * Cheap classification of frames received through the legacy path. The FPGA
+ * hands over linear skbs, and this is called after eth_type_trans(), so
+ * skb->data points to the network header.
+ */
+static enum ra_net_rx_class ra_net_rx_classify(const struct sk_buff *skb)
+{
+	const struct iphdr *iph;
+	const struct udphdr *udph;
+	unsigned int ihl;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_ARP):
+		return RA_NET_RX_CLASS_ARP;
+
+	case htons(ETH_P_1588):
+		if (skb_headlen(skb) < 1)
+			break;
+
+		/* Event messages have a messageType below 0x8 */
+		if ((skb->data[0] & 0x0f) < 0x8)
+			return RA_NET_RX_CLASS_PTP_EVENT;
+
+		return RA_NET_RX_CLASS_PTP_GENERAL;
+
+	case htons(ETH_P_IP):
+		if (skb_headlen(skb) < sizeof(*iph))
+			break;
+
+		iph = (const struct iphdr *)skb->data;
+
+		if (iph->protocol == IPPROTO_IGMP)
+			return RA_NET_RX_CLASS_IGMP;
+
+		ihl = iph->ihl * 4;
+
+		if (iph->protocol == IPPROTO_UDP &&
+		    !(iph->frag_off & htons(IP_OFFSET)) &&
+		    skb_headlen(skb) >= ihl + sizeof(*udph)) {
+			udph = (const struct udphdr *)(skb->data + ihl);
+
+			switch (ntohs(udph->dest)) {
+			case PTP_EV_PORT:
+				return RA_NET_RX_CLASS_PTP_EVENT;
+			case PTP_GEN_PORT:
+				return RA_NET_RX_CLASS_PTP_GENERAL;
+			}
+		}
+
+		if (skb->pkt_type == PACKET_HOST)
+			return RA_NET_RX_CLASS_UNICAST_IP;
+
+		break;
+	}
+
+	if (skb->pkt_type == PACKET_MULTICAST ||
+	    skb->pkt_type == PACKET_BROADCAST)
+		return RA_NET_RX_CLASS_MULTICAST;
+
+	return RA_NET_RX_CLASS_OTHER;
+}
+
+void ra_net_rx_account(struct ra_net_priv *priv, const struct sk_buff *skb,
+		       unsigned int len)
+{
+	struct ra_net_rx_class_stats *stats = this_cpu_ptr(priv->rx_class_stats);
+	enum ra_net_rx_class class = ra_net_rx_classify(skb);
+
+	u64_stats_update_begin(&stats->syncp);
+	u64_stats_inc(&stats->packets[class]);
+	u64_stats_add(&stats->bytes[class], len);
+	u64_stats_update_end(&stats->syncp);
+}
+
+void ra_net_rx_class_read(struct ra_net_priv *priv, enum ra_net_rx_class class,
+			  u64 *packets, u64 *bytes)
+{
+	int cpu;
+
+	*packets = 0;
+	*bytes = 0;
+
+	for_each_possible_cpu(cpu) {
+		const struct ra_net_rx_class_stats *stats =
+			per_cpu_ptr(priv->rx_class_stats, cpu);
+		unsigned int start;
+		u64 p, b;
+
+		do {
+			start = u64_stats_fetch_begin(&stats->syncp);
+			p = u64_stats_read(&stats->packets[class]);
+			b = u64_stats_read(&stats->bytes[class]);
+		} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+		*packets += p;
+		*bytes += b;
+	}
+}
+
+int ra_net_rx_class_init(struct ra_net_priv *priv)
+{
+	int cpu;
+
+	priv->rx_class_stats = devm_alloc_percpu(priv->dev,
+						 struct ra_net_rx_class_stats);
+	if (!priv->rx_class_stats)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(priv->rx_class_stats, cpu)->syncp);
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "main.h"
+
+DEFINE_STATIC_KEY_FALSE(ra_net_latency_key);
+static DEFINE_MUTEX(ra_net_latency_mutex);
+
+static void ra_net_latency_hist_show(struct seq_file *s, const char *name,
+				     const struct ra_net_latency_hist *h)
+{
+	u64 total = 0;
+	int i;
+
+	seq_printf(s, "%s:\n", name);
+
+	for (i = 0; i < RA_NET_LATENCY_BUCKETS; i++) {
+		u64 count = READ_ONCE(h->buckets[i]);
+
+		if (count == 0)
+			continue;
+
+		total += count;
+
+		if (i == 0)
+			seq_printf(s, "  %12s ns: %llu\n", "0", count);
+		else if (i == RA_NET_LATENCY_BUCKETS - 1)
+			seq_printf(s, "  >= %9llu ns: %llu\n",
+				   1ULL << (i - 1), count);
+		else
+			seq_printf(s, "  %12llu ns: %llu\n",
+				   1ULL << (i - 1), count);
+	}
+
+	seq_printf(s, "  Total: %llu\n\n", total);
+}
+
+static int ra_net_latency_show(struct seq_file *s, void *p)
+{
+	struct ra_net_priv *priv = s->private;
+
+	seq_printf(s, "Enabled: %s\n\n", priv->lat.enable ? "yes" : "no");
+
+	ra_net_latency_hist_show(s, "RX IRQ -> NAPI poll / DMA completion",
+				 &priv->lat.irq_to_poll);
+	ra_net_latency_hist_show(s, "RX poll start -> skb hand-off",
+				 &priv->lat.poll_to_rx);
+	ra_net_latency_hist_show(s, "TX ndo_start_xmit -> TX_CONFIG write",
+				 &priv->lat.tx_xmit);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(ra_net_latency);
+
+static int ra_net_latency_enable_get(void *data, u64 *val)
+{
+	struct ra_net_priv *priv = data;
+
+	*val = priv->lat.enable;
+
+	return 0;
+}
+
+static int ra_net_latency_enable_set(void *data, u64 val)
+{
+	struct ra_net_priv *priv = data;
+	bool enable = !!val;
+
+	mutex_lock(&ra_net_latency_mutex);
+
+	if (enable != priv->lat.enable) {
+		if (enable) {
+			/* Start over with fresh histograms */
+			memset(&priv->lat.irq_to_poll, 0, sizeof(priv->lat.irq_to_poll));
+			memset(&priv->lat.poll_to_rx, 0, sizeof(priv->lat.poll_to_rx));
+			memset(&priv->lat.tx_xmit, 0, sizeof(priv->lat.tx_xmit));
+			priv->lat.irq_ts = 0;
+			priv->lat.poll_ts = 0;
+
+			WRITE_ONCE(priv->lat.enable, true);
+			static_branch_inc(&ra_net_latency_key);
+		} else {
+			WRITE_ONCE(priv->lat.enable, false);
+			static_branch_dec(&ra_net_latency_key);
+		}
+	}
+
+	mutex_unlock(&ra_net_latency_mutex);
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(ra_net_latency_enable_fops,
+			 ra_net_latency_enable_get,
+			 ra_net_latency_enable_set, "%llu\n");
+
+static void ra_net_remove_debugfs(void *data)
+{
+	struct ra_net_priv *priv = data;
+
+	debugfs_remove_recursive(priv->debugfs);
+	ra_net_latency_enable_set(priv, 0);
+}
+
+/*
+ * debugfs is optional instrumentation, so errors are not checked, as usual.
+ * Without it, the latency histograms simply stay disabled.
+ */
+void ra_net_debugfs_init(struct ra_net_priv *priv)
+{
+	priv->debugfs = debugfs_create_dir(dev_name(priv->dev), NULL);
+
+	if (devm_add_action_or_reset(priv->dev, ra_net_remove_debugfs, priv))
+		return;
+
+	debugfs_create_file("latency", 0444, priv->debugfs,
+			    priv, &ra_net_latency_fops);
+	debugfs_create_file_unsafe("latency-enable", 0644, priv->debugfs,
+				   priv, &ra_net_latency_enable_fops);
+}
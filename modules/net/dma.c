@@ -5,6 +5,7 @@
 #include <linux/etherdevice.h>
 
 #include "main.h"
+#include "trace.h"
 
 static void ra_net_dma_release_channel(void *data) {
 	struct dma_chan *chan = data;
@@ -89,6 +90,15 @@ static void ra_net_dma_rx_callback(void *arg)
 	struct ra_net_priv *priv = ctx->priv;
 	struct device *dma_dev;
 
+	if (ra_net_latency_enabled(priv)) {
+		priv->lat.poll_ts = ktime_get();
+		ra_net_latency_record(priv, &priv->lat.irq_to_poll,
+				      priv->lat.irq_ts);
+		priv->lat.irq_ts = 0;
+	}
+
+	trace_ra_net_dma_complete(priv->ndev, ctx->buf_len, ctx->timestamped);
+
 	dma_dev = dmaengine_get_dma_device(priv->dma_rx_chan);
 
 	dma_unmap_single(dma_dev, ctx->dma_addr,
@@ -116,6 +126,10 @@ static void ra_net_dma_rx_callback(void *arg)
 	priv->ndev->stats.rx_bytes += ctx->len;
 	spin_unlock(&priv->lock);
 
+	ra_net_rx_account(priv, ctx->skb, ctx->len);
+
+	ra_net_latency_record(priv, &priv->lat.poll_to_rx, priv->lat.poll_ts);
+
 	netif_rx(ctx->skb);
 
 	if (netif_queue_stopped(priv->ndev))
@@ -199,6 +213,8 @@ static int ra_net_dma_rx_one(struct ra_net_priv *priv)
 		goto err_free_ctx;
 	}
 
+	trace_ra_net_dma_submit(priv->ndev, buf_len, timestamped);
+
 	dma_async_issue_pending(priv->dma_rx_chan);
 
 	return 0;
@@ -15,8 +15,15 @@
 
 #include "main.h"
 
+#define RA_NET_PP_STATS_INTERVAL	HZ
+
+/* The packet processor supports a single UDP destination port filter */
+#define RA_NET_UDP_FILTER_RULES		1
+
 static const char ra_net_gstrings_stats[][ETH_GSTRING_LEN] = {
 	"udp_throttled_packets",
+	"udp_throttled_pps",
+	"rx_legacy_pps",
 	"fifo_err_cnt",
 
 	"rx_packets_parsed",
@@ -38,10 +45,27 @@ static const char ra_net_gstrings_stats[][ETH_GSTRING_LEN] = {
 	"tx_broadcast_packets",
 	"tx_pad_packets",
 	"tx_oversize_packets",
+
+	"rx_legacy_ptp_event_packets",
+	"rx_legacy_ptp_event_bytes",
+	"rx_legacy_ptp_general_packets",
+	"rx_legacy_ptp_general_bytes",
+	"rx_legacy_arp_packets",
+	"rx_legacy_arp_bytes",
+	"rx_legacy_igmp_packets",
+	"rx_legacy_igmp_bytes",
+	"rx_legacy_other_multicast_packets",
+	"rx_legacy_other_multicast_bytes",
+	"rx_legacy_unicast_ip_packets",
+	"rx_legacy_unicast_ip_bytes",
+	"rx_legacy_other_packets",
+	"rx_legacy_other_bytes",
 };
 
 struct ra_net_stats {
 	u64 udp_throttled_packets;
+	u64 udp_throttled_pps;
+	u64 rx_legacy_pps;
 	u64 fifo_err_cnt;
 
 	u64 rx_packets_parsed;
@@ -63,15 +87,174 @@ struct ra_net_stats {
 	u64 tx_broadcast_packets;
 	u64 tx_pad_packets;
 	u64 tx_oversize_packets;
+
+	u64 rx_legacy_ptp_event_packets;
+	u64 rx_legacy_ptp_event_bytes;
+	u64 rx_legacy_ptp_general_packets;
+	u64 rx_legacy_ptp_general_bytes;
+	u64 rx_legacy_arp_packets;
+	u64 rx_legacy_arp_bytes;
+	u64 rx_legacy_igmp_packets;
+	u64 rx_legacy_igmp_bytes;
+	u64 rx_legacy_other_multicast_packets;
+	u64 rx_legacy_other_multicast_bytes;
+	u64 rx_legacy_unicast_ip_packets;
+	u64 rx_legacy_unicast_ip_bytes;
+	u64 rx_legacy_other_packets;
+	u64 rx_legacy_other_bytes;
 };
 
+/* Must be called with priv->pp_stats.lock held */
+static void ra_net_pp_stats_update(struct ra_net_priv *priv)
+{
+	struct ra_net_pp_stats *pp = &priv->pp_stats;
+	u32 v;
+
+	v = ra_net_ior(priv, RA_NET_PP_CNT_UDP_THROTTLE);
+	pp->udp_throttled += (u32)(v - pp->udp_throttled_last);
+	pp->udp_throttled_last = v;
+
+	v = ra_net_ior(priv, RA_NET_PP_CNT_RX_LEGACY);
+	pp->rx_legacy += (u32)(v - pp->rx_legacy_last);
+	pp->rx_legacy_last = v;
+}
+
+/* Restarts the extended counters from what the hardware holds */
+static void ra_net_pp_stats_restart(struct ra_net_priv *priv)
+{
+	struct ra_net_pp_stats *pp = &priv->pp_stats;
+
+	pp->udp_throttled_last = ra_net_ior(priv, RA_NET_PP_CNT_UDP_THROTTLE);
+	pp->udp_throttled = pp->udp_throttled_last;
+	pp->udp_throttled_rate_last = pp->udp_throttled;
+	pp->udp_throttled_pps = 0;
+
+	pp->rx_legacy_last = ra_net_ior(priv, RA_NET_PP_CNT_RX_LEGACY);
+	pp->rx_legacy = pp->rx_legacy_last;
+	pp->rx_legacy_rate_last = pp->rx_legacy;
+	pp->rx_legacy_pps = 0;
+
+	pp->rate_jiffies = jiffies;
+}
+
+/*
+ * Brings an extended counter up to date after RA_NET_PP_CNT_RST has been
+ * written. @before is the hardware value right before. Only a counter which
+ * has actually been reset restarts from the hardware value; the rate keeps
+ * the packets counted since its baseline, modulo 2^64.
+ */
+static void ra_net_pp_counter_resync(struct ra_net_priv *priv, u32 reg,
+				     u32 before, u32 *last, u64 *total,
+				     u64 *rate_last)
+{
+	u32 v = ra_net_ior(priv, reg);
+
+	*total += (u32)(before - *last);
+
+	if (v < before) {
+		*rate_last += v - *total;
+		*total = v;
+	} else {
+		*total += (u32)(v - before);
+	}
+
+	*last = v;
+}
+
+/*
+ * Resets the packet processor counters selected by @mask. Extended counters
+ * which are reset report the raw hardware values again, as right after probe.
+ */
+void ra_net_pp_stats_reset(struct ra_net_priv *priv, u32 mask)
+{
+	struct ra_net_pp_stats *pp = &priv->pp_stats;
+	u32 udp_throttled, rx_legacy;
+
+	spin_lock(&pp->lock);
+
+	udp_throttled = ra_net_ior(priv, RA_NET_PP_CNT_UDP_THROTTLE);
+	rx_legacy = ra_net_ior(priv, RA_NET_PP_CNT_RX_LEGACY);
+
+	ra_net_iow(priv, RA_NET_PP_CNT_RST, mask);
+
+	ra_net_pp_counter_resync(priv, RA_NET_PP_CNT_UDP_THROTTLE,
+				 udp_throttled, &pp->udp_throttled_last,
+				 &pp->udp_throttled,
+				 &pp->udp_throttled_rate_last);
+	ra_net_pp_counter_resync(priv, RA_NET_PP_CNT_RX_LEGACY, rx_legacy,
+				 &pp->rx_legacy_last, &pp->rx_legacy,
+				 &pp->rx_legacy_rate_last);
+
+	spin_unlock(&pp->lock);
+}
+
+static void ra_net_pp_stats_work(struct work_struct *work)
+{
+	struct ra_net_priv *priv =
+		container_of(to_delayed_work(work), struct ra_net_priv,
+			     pp_stats.work);
+	struct ra_net_pp_stats *pp = &priv->pp_stats;
+	unsigned long now = jiffies;
+	unsigned long elapsed;
+
+	spin_lock(&pp->lock);
+
+	ra_net_pp_stats_update(priv);
+
+	elapsed = now - pp->rate_jiffies;
+	if (elapsed > 0) {
+		pp->udp_throttled_pps =
+			div_u64((pp->udp_throttled - pp->udp_throttled_rate_last) * HZ,
+				elapsed);
+		pp->rx_legacy_pps =
+			div_u64((pp->rx_legacy - pp->rx_legacy_rate_last) * HZ,
+				elapsed);
+	}
+
+	pp->udp_throttled_rate_last = pp->udp_throttled;
+	pp->rx_legacy_rate_last = pp->rx_legacy;
+	pp->rate_jiffies = now;
+
+	spin_unlock(&pp->lock);
+
+	schedule_delayed_work(&pp->work, RA_NET_PP_STATS_INTERVAL);
+}
+
+static void ra_net_pp_stats_cancel(void *work)
+{
+	cancel_delayed_work_sync(work);
+}
+
+int ra_net_pp_stats_init(struct ra_net_priv *priv)
+{
+	struct ra_net_pp_stats *pp = &priv->pp_stats;
+
+	spin_lock_init(&pp->lock);
+	INIT_DELAYED_WORK(&pp->work, ra_net_pp_stats_work);
+
+	ra_net_pp_stats_restart(priv);
+
+	schedule_delayed_work(&pp->work, RA_NET_PP_STATS_INTERVAL);
+
+	return devm_add_action_or_reset(priv->dev, ra_net_pp_stats_cancel,
+					&pp->work);
+}
+
 static void ra_net_read_stats(struct ra_net_priv *priv,
 			      struct ra_net_stats *stats)
 {
+	struct ra_net_pp_stats *pp = &priv->pp_stats;
+
 	BUILD_BUG_ON(ARRAY_SIZE(ra_net_gstrings_stats) != sizeof(*stats) / sizeof(u64));
 
-	stats->udp_throttled_packets =
-		ra_net_ior(priv, RA_NET_PP_CNT_UDP_THROTTLE);
+	spin_lock(&pp->lock);
+	ra_net_pp_stats_update(priv);
+	stats->udp_throttled_packets = pp->udp_throttled;
+	stats->udp_throttled_pps = pp->udp_throttled_pps;
+	stats->rx_legacy_packets = pp->rx_legacy;
+	stats->rx_legacy_pps = pp->rx_legacy_pps;
+	spin_unlock(&pp->lock);
+
 	stats->fifo_err_cnt =
 		ra_net_ior(priv, RA_NET_FIFO_ERR_CNT);
 
@@ -85,8 +268,6 @@ static void ra_net_read_stats(struct ra_net_priv *priv,
 		ra_net_ior(priv, RA_NET_PP_CNT_RX_STREAM_DROP);
 	stats->rx_stream_packets =
 		ra_net_ior(priv, RA_NET_PP_CNT_RX_STREAM);
-	stats->rx_legacy_packets =
-		ra_net_ior(priv, RA_NET_PP_CNT_RX_LEGACY);
 	stats->rx_unicast_packets =
 		ra_net_ior(priv, RA_NET_RX_UNICAST_PKT_CNT);
 	stats->rx_broadcast_packets =
@@ -112,6 +293,28 @@ static void ra_net_read_stats(struct ra_net_priv *priv,
 		ra_net_ior(priv, RA_NET_TX_PAD_PKT_CNT);
 	stats->tx_oversize_packets =
 		ra_net_ior(priv, RA_NET_TX_OVERSIZE_PKT_CNT);
+
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_PTP_EVENT,
+			     &stats->rx_legacy_ptp_event_packets,
+			     &stats->rx_legacy_ptp_event_bytes);
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_PTP_GENERAL,
+			     &stats->rx_legacy_ptp_general_packets,
+			     &stats->rx_legacy_ptp_general_bytes);
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_ARP,
+			     &stats->rx_legacy_arp_packets,
+			     &stats->rx_legacy_arp_bytes);
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_IGMP,
+			     &stats->rx_legacy_igmp_packets,
+			     &stats->rx_legacy_igmp_bytes);
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_MULTICAST,
+			     &stats->rx_legacy_other_multicast_packets,
+			     &stats->rx_legacy_other_multicast_bytes);
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_UNICAST_IP,
+			     &stats->rx_legacy_unicast_ip_packets,
+			     &stats->rx_legacy_unicast_ip_bytes);
+	ra_net_rx_class_read(priv, RA_NET_RX_CLASS_OTHER,
+			     &stats->rx_legacy_other_packets,
+			     &stats->rx_legacy_other_bytes);
 }
 
 static void ra_net_get_strings(struct net_device *netdev, u32 stringset, u8 *buf)
@@ -208,6 +411,127 @@ static int ra_net_ethtool_get_ts_info(struct net_device *ndev,
 	return 0;
 }
 
+/* UDP filter, exposed as ntuple rule */
+
+static bool ra_net_udp_filter_get(struct ra_net_priv *priv, u16 *port)
+{
+	u32 v = ra_net_ior(priv, RA_NET_PP_CNT_UDP_FILTER_CTRL);
+
+	*port = v & RA_NET_PP_CNT_UDP_FILTER_CTRL_PORT_MASK;
+
+	return !!(v & RA_NET_PP_CNT_UDP_FILTER_CTRL_EN);
+}
+
+static int ra_net_ethtool_get_rxnfc(struct net_device *ndev,
+				    struct ethtool_rxnfc *cmd,
+				    u32 *rule_locs)
+{
+	struct ra_net_priv *priv = netdev_priv(ndev);
+	struct ethtool_rx_flow_spec *fs = &cmd->fs;
+	bool enabled;
+	u16 port;
+
+	enabled = ra_net_udp_filter_get(priv, &port);
+
+	switch (cmd->cmd) {
+	case ETHTOOL_GRXRINGS:
+		cmd->data = 1;
+		return 0;
+
+	case ETHTOOL_GRXCLSRLCNT:
+		cmd->rule_cnt = enabled ? 1 : 0;
+		cmd->data = RA_NET_UDP_FILTER_RULES | RX_CLS_LOC_SPECIAL;
+		return 0;
+
+	case ETHTOOL_GRXCLSRULE:
+		if (fs->location != 0 || !enabled)
+			return -ENOENT;
+
+		memset(&fs->h_u, 0, sizeof(fs->h_u));
+		memset(&fs->m_u, 0, sizeof(fs->m_u));
+
+		fs->flow_type = UDP_V4_FLOW;
+		fs->h_u.udp_ip4_spec.pdst = htons(port);
+		fs->m_u.udp_ip4_spec.pdst = htons(0xffff);
+		fs->ring_cookie = RX_CLS_FLOW_DISC;
+
+		return 0;
+
+	case ETHTOOL_GRXCLSRLALL:
+		if (enabled) {
+			if (cmd->rule_cnt < 1)
+				return -EMSGSIZE;
+
+			rule_locs[0] = 0;
+		}
+
+		cmd->rule_cnt = enabled ? 1 : 0;
+		cmd->data = RA_NET_UDP_FILTER_RULES;
+		return 0;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static int ra_net_udp_filter_validate(const struct ethtool_rx_flow_spec *fs)
+{
+	const struct ethtool_tcpip4_spec *mask = &fs->m_u.udp_ip4_spec;
+
+	if (fs->flow_type != UDP_V4_FLOW)
+		return -EOPNOTSUPP;
+
+	if (fs->location != 0 && fs->location != RX_CLS_LOC_ANY)
+		return -EINVAL;
+
+	/* Only the destination port can be matched, and only exactly */
+	if (mask->ip4src || mask->ip4dst || mask->psrc || mask->tos ||
+	    mask->pdst != htons(0xffff))
+		return -EOPNOTSUPP;
+
+	if (fs->h_u.udp_ip4_spec.pdst == 0)
+		return -EINVAL;
+
+	/* Matching packets are throttled before they reach the legacy FIFO */
+	if (fs->ring_cookie != RX_CLS_FLOW_DISC)
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+static int ra_net_ethtool_set_rxnfc(struct net_device *ndev,
+				    struct ethtool_rxnfc *cmd)
+{
+	struct ra_net_priv *priv = netdev_priv(ndev);
+	struct ethtool_rx_flow_spec *fs = &cmd->fs;
+	int ret;
+	u32 v;
+
+	switch (cmd->cmd) {
+	case ETHTOOL_SRXCLSRLINS:
+		ret = ra_net_udp_filter_validate(fs);
+		if (ret < 0)
+			return ret;
+
+		fs->location = 0;
+
+		v = ntohs(fs->h_u.udp_ip4_spec.pdst);
+		v |= RA_NET_PP_CNT_UDP_FILTER_CTRL_EN;
+		ra_net_iow(priv, RA_NET_PP_CNT_UDP_FILTER_CTRL, v);
+
+		return 0;
+
+	case ETHTOOL_SRXCLSRLDEL:
+		if (fs->location != 0)
+			return -ENOENT;
+
+		ra_net_iow(priv, RA_NET_PP_CNT_UDP_FILTER_CTRL, 0);
+
+		return 0;
+	}
+
+	return -EOPNOTSUPP;
+}
+
 static int ra_net_ethtool_get_module_info(struct net_device *ndev,
 					  struct ethtool_modinfo *modinfo)
 {
@@ -249,6 +573,8 @@ const struct ethtool_ops ra_net_ethtool_ops = {
 	.get_regs_len		= ra_net_ethtool_getregslen,
 	.get_regs		= ra_net_ethtool_getregs,
 	.get_ts_info		= ra_net_ethtool_get_ts_info,
+	.get_rxnfc		= ra_net_ethtool_get_rxnfc,
+	.set_rxnfc		= ra_net_ethtool_set_rxnfc,
 	.get_module_info	= ra_net_ethtool_get_module_info,
 	.get_module_eeprom	= ra_net_ethtool_get_module_eeprom,
 	.get_link_ksettings	= ra_net_ethtool_get_link_ksettings,
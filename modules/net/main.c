@@ -19,11 +19,21 @@
 
 #include "main.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 static int ra_net_napi_poll(struct napi_struct *napi, int budget)
 {
 	struct ra_net_priv *priv = container_of(napi, struct ra_net_priv, napi);
 	int count;
 
+	if (ra_net_latency_enabled(priv)) {
+		priv->lat.poll_ts = ktime_get();
+		ra_net_latency_record(priv, &priv->lat.irq_to_poll,
+				      priv->lat.irq_ts);
+		priv->lat.irq_ts = 0;
+	}
+
 	for (count = 0; count < budget; count++) {
 		struct sk_buff *skb;
 
@@ -37,13 +47,16 @@ static int ra_net_napi_poll(struct napi_struct *napi, int budget)
 
 		dev_dbg(priv->dev, "%s() pkt_len %d\n", __func__, pkt_len);
 
+		trace_ra_net_rx_packet(priv->ndev, pkt_len,
+				       status & RA_NET_RX_STATE_PACKET_HAS_PTP_TS);
+
 		skb = napi_alloc_skb(&priv->napi, pkt_len_padded+4);
 		if (unlikely(!skb)) {
 			priv->ndev->stats.rx_fifo_errors++;
 			break;
 		}
 
-		ra_net_ior_rep(priv, RA_NET_RX_FIFO, skb->data,	pkt_len_padded);
+		ra_net_fifo_read(priv, skb->data, pkt_len_padded);
 
 		/* FPGA inserts 2 padding bytes */
 		skb_reserve(skb, RA_NET_RX_PADDING_BYTES);
@@ -60,11 +73,18 @@ static int ra_net_napi_poll(struct napi_struct *napi, int budget)
 		priv->ndev->stats.rx_packets++;
 		priv->ndev->stats.rx_bytes += pkt_len;
 
+		ra_net_rx_account(priv, skb, pkt_len);
+
 		// skb_dump(KERN_DEBUG, skb, true);
 
+		ra_net_latency_record(priv, &priv->lat.poll_to_rx,
+				      priv->lat.poll_ts);
+
 		napi_gro_receive(&priv->napi, skb);
 	}
 
+	trace_ra_net_napi_poll(priv->ndev, count, budget);
+
 	if (count < budget)
 		napi_complete_done(&priv->napi, count);
 
@@ -81,6 +101,7 @@ static irqreturn_t ra_net_irqhandler(int irq, void *dev_id)
 	struct ra_net_priv *priv = dev_id;
 	struct net_device *ndev = priv->ndev;
 	struct device *dev = priv->dev;
+	ktime_t now = ra_net_latency_start(priv);
 	u32 mask, pp_mask, irqs, pp_irqs;
 
 	dev_dbg(dev, "%s()\n", __func__);
@@ -96,6 +117,8 @@ static irqreturn_t ra_net_irqhandler(int irq, void *dev_id)
 	if (!irqs && !pp_irqs)
 		return IRQ_NONE;
 
+	trace_ra_net_irq(ndev, irqs, pp_irqs);
+
 	dev_dbg(dev, "irqs 0x%04x pp_irqs 0x%04x\n", irqs, pp_irqs);
 
 	if (irqs & RA_NET_IRQ_RX_OVERRUN) {
@@ -107,6 +130,8 @@ static irqreturn_t ra_net_irqhandler(int irq, void *dev_id)
 	if (irqs & RA_NET_IRQ_RX_PACKET_AVAILABLE) {
 		ra_net_irq_disable(priv, RA_NET_IRQ_RX_PACKET_AVAILABLE);
 
+		priv->lat.irq_ts = now;
+
 		if (priv->dma_rx_chan)
 			ra_net_dma_rx(priv);
 		else
@@ -144,6 +169,9 @@ static int ra_net_init(struct net_device *ndev)
 	else
 		dev_info(dev, "device does not support VLAN filtering\n");
 
+	/* The UDP filter of the packet processor is exposed as ntuple rule */
+	ndev->features |= NETIF_F_NTUPLE;
+
 	return 0;
 }
 
@@ -165,6 +193,8 @@ static void ra_net_flush_rx_fifo(struct ra_net_priv *priv)
 
 static void ra_net_reset(struct ra_net_priv *priv)
 {
+	trace_ra_net_reset(priv->ndev);
+
 	ra_net_irq_disable(priv, ~0);
 	ra_net_pp_irq_disable(priv, ~0);
 
@@ -239,6 +269,7 @@ static int ra_net_stop(struct net_device *ndev)
 static int ra_net_hw_xmit_skb(struct sk_buff *skb, struct net_device *ndev)
 {
 	struct ra_net_priv *priv = netdev_priv(ndev);
+	ktime_t start = ra_net_latency_start(priv);
 	bool free_skb = true, short_packet = false;
 	struct device *dev = priv->dev;
 	unsigned int len = skb->len;
@@ -301,6 +332,9 @@ static int ra_net_hw_xmit_skb(struct sk_buff *skb, struct net_device *ndev)
 
 	free = ra_net_ior(priv, RA_NET_TX_STATE) & RA_NET_TX_STATE_SPACE_AVAILABLE_MASK;
 
+	trace_ra_net_tx_enqueue(ndev, aligned_len, free,
+				free < RA_NET_TX_FIFO_MIN_SPACE_AVAILABLE);
+
 	if (free < RA_NET_TX_FIFO_MIN_SPACE_AVAILABLE) {
 		dev_dbg(dev, "TX FIFO space is running low: %d\n", free);
 
@@ -333,7 +367,7 @@ static int ra_net_hw_xmit_skb(struct sk_buff *skb, struct net_device *ndev)
 	dev_dbg(dev, "Transmitting packet: len = %d; aligned = %d\n",
 		len, aligned_len);
 
-	ra_net_iow_rep(priv, RA_NET_TX_FIFO, buf, aligned_len);
+	ra_net_fifo_write(priv, buf, aligned_len);
 
 	if (ra_net_tx_ts_queue(priv, skb)) {
 		/* tell FPGA to timestamp this packet */
@@ -344,6 +378,8 @@ static int ra_net_hw_xmit_skb(struct sk_buff *skb, struct net_device *ndev)
 	/* start transmission of data */
 	ra_net_iow(priv, RA_NET_TX_CONFIG, len);
 
+	ra_net_latency_record(priv, &priv->lat.tx_xmit, start);
+
 	/* dummy access needed by FPGA to have enough clock cycles */
 	ra_net_ior(priv, RA_NET_TX_STATE);
 
@@ -595,6 +631,14 @@ static int ra_net_drv_probe(struct platform_device *pdev)
 
 	ra_net_tx_ts_init(priv);
 
+	ret = ra_net_rx_class_init(priv);
+	if (ret < 0)
+		return ret;
+
+	ret = ra_net_pp_stats_init(priv);
+	if (ret < 0)
+		return ret;
+
 	ndev->irq = irq;
 	ndev->netdev_ops = &ra_net_netdev_ops;
 	ndev->min_mtu = 68;
@@ -625,6 +669,23 @@ static int ra_net_drv_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	tmp = 32;
+	of_property_read_u32(node, "lawo,fifo-access-width", &tmp);
+	switch (tmp) {
+	case 32:
+		break;
+	case 64:
+		if (IS_ENABLED(CONFIG_64BIT)) {
+			priv->fifo_64bit = true;
+			break;
+		}
+
+		fallthrough;
+	default:
+		dev_err(dev, "Unsupported FIFO access width: %u\n", tmp);
+		return -EINVAL;
+	}
+
 	ret = ra_net_dma_probe(priv);
 	if (ret < 0) {
 		dev_err(dev, "DMA init failed: %d\n", ret);
@@ -669,11 +730,14 @@ static int ra_net_drv_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	ra_net_debugfs_init(priv);
+
 	val = ra_net_ior(priv, RA_NET_RAV_CORE_VERSION);
 
-	dev_info(dev, "Ravenna ethernet driver, core version: %02x.%02x, %s mode\n",
+	dev_info(dev, "Ravenna ethernet driver, core version: %02x.%02x, %s mode, %d-bit FIFO access\n",
 		 (val >> 8) & 0xff, val & 0xff,
-		 priv->dma_rx_chan ? "DMA" : "FIFO");
+		 priv->dma_rx_chan ? "DMA" : "FIFO",
+		 priv->fifo_64bit ? 64 : 32);
 
 	return 0;
 }
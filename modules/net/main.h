@@ -6,6 +6,9 @@
 #include <linux/phylink.h>
 #include <linux/ptp_classify.h>
 #include <linux/dmaengine.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/u64_stats_sync.h>
 
 #include "regs.h"
 
@@ -44,6 +47,58 @@ struct ra_net_tx_ts {
 	unsigned int ts_wr_idx;
 };
 
+/* log2 buckets, in nanoseconds */
+#define RA_NET_LATENCY_BUCKETS	32
+
+struct ra_net_latency_hist {
+	u64 buckets[RA_NET_LATENCY_BUCKETS];
+};
+
+struct ra_net_latency {
+	bool enable;
+	ktime_t irq_ts;
+	ktime_t poll_ts;
+
+	struct ra_net_latency_hist irq_to_poll;
+	struct ra_net_latency_hist poll_to_rx;
+	struct ra_net_latency_hist tx_xmit;
+};
+
+enum ra_net_rx_class {
+	RA_NET_RX_CLASS_PTP_EVENT,
+	RA_NET_RX_CLASS_PTP_GENERAL,
+	RA_NET_RX_CLASS_ARP,
+	RA_NET_RX_CLASS_IGMP,
+	RA_NET_RX_CLASS_MULTICAST,
+	RA_NET_RX_CLASS_UNICAST_IP,
+	RA_NET_RX_CLASS_OTHER,
+	_RA_NET_RX_CLASS_MAX
+};
+
+struct ra_net_rx_class_stats {
+	struct u64_stats_sync	syncp;
+	u64_stats_t		packets[_RA_NET_RX_CLASS_MAX];
+	u64_stats_t		bytes[_RA_NET_RX_CLASS_MAX];
+};
+
+/* Software extension of 32-bit packet processor counters */
+struct ra_net_pp_stats {
+	spinlock_t		lock;
+	struct delayed_work	work;
+
+	u32			udp_throttled_last;
+	u64			udp_throttled;
+	u32			rx_legacy_last;
+	u64			rx_legacy;
+
+	/* Rates, updated periodically by the work */
+	unsigned long		rate_jiffies;
+	u64			udp_throttled_rate_last;
+	u64			rx_legacy_rate_last;
+	u64			udp_throttled_pps;
+	u64			rx_legacy_pps;
+};
+
 struct ra_net_priv {
 	void __iomem *regs;
 
@@ -61,6 +116,8 @@ struct ra_net_priv {
 	struct dma_chan		*dma_rx_chan;
 	dma_addr_t		dma_addr;
 
+	bool fifo_64bit;
+
 	bool tx_throttle;
 
 	int phc_index;
@@ -69,8 +126,43 @@ struct ra_net_priv {
 	bool rx_ts_enable;
 
 	int rx_dropped_packets_at_probe;
+
+	struct ra_net_rx_class_stats __percpu *rx_class_stats;
+	struct ra_net_pp_stats pp_stats;
+
+	struct dentry *debugfs;
+	struct ra_net_latency lat;
 };
 
+DECLARE_STATIC_KEY_FALSE(ra_net_latency_key);
+
+static inline bool ra_net_latency_enabled(struct ra_net_priv *priv)
+{
+	return static_branch_unlikely(&ra_net_latency_key) &&
+	       READ_ONCE(priv->lat.enable);
+}
+
+static inline ktime_t ra_net_latency_start(struct ra_net_priv *priv)
+{
+	return ra_net_latency_enabled(priv) ? ktime_get() : 0;
+}
+
+static inline void ra_net_latency_record(struct ra_net_priv *priv,
+					 struct ra_net_latency_hist *h,
+					 ktime_t start)
+{
+	s64 ns;
+
+	if (!ra_net_latency_enabled(priv) || !start)
+		return;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ns < 0)
+		ns = 0;
+
+	h->buckets[min_t(unsigned int, fls64(ns), RA_NET_LATENCY_BUCKETS - 1)]++;
+}
+
 static inline void ra_net_iow(struct ra_net_priv *priv, off_t offset, u32 value)
 {
 	iowrite32(value, priv->regs + offset);
@@ -93,6 +185,45 @@ static inline void ra_net_ior_rep(struct ra_net_priv *priv, off_t offset,
 	ioread32_rep(priv->regs + offset, buf, len  / sizeof(u32));
 }
 
+/*
+ * The legacy RX and TX FIFOs can optionally be accessed with 64-bit bus
+ * transactions. Lengths are always 32-bit aligned, so a trailing 32-bit word
+ * is transferred with a narrow access.
+ */
+static inline void ra_net_fifo_read(struct ra_net_priv *priv,
+				    void *buf, size_t len)
+{
+#ifdef CONFIG_64BIT
+	if (priv->fifo_64bit) {
+		size_t len64 = round_down(len, sizeof(u64));
+
+		ioread64_rep(priv->regs + RA_NET_RX_FIFO, buf,
+			     len64 / sizeof(u64));
+		buf += len64;
+		len -= len64;
+	}
+#endif
+
+	ioread32_rep(priv->regs + RA_NET_RX_FIFO, buf, len / sizeof(u32));
+}
+
+static inline void ra_net_fifo_write(struct ra_net_priv *priv,
+				     const void *buf, size_t len)
+{
+#ifdef CONFIG_64BIT
+	if (priv->fifo_64bit) {
+		size_t len64 = round_down(len, sizeof(u64));
+
+		iowrite64_rep(priv->regs + RA_NET_TX_FIFO, buf,
+			      len64 / sizeof(u64));
+		buf += len64;
+		len -= len64;
+	}
+#endif
+
+	iowrite32_rep(priv->regs + RA_NET_TX_FIFO, buf, len / sizeof(u32));
+}
+
 static inline void ra_net_iow_mask(struct ra_net_priv *priv, off_t offset,
 				   u32 mask, u32 val)
 {
@@ -136,6 +267,9 @@ static inline void ra_net_pp_irq_disable(struct ra_net_priv *priv, u32 bit)
 extern const struct ethtool_ops ra_net_ethtool_ops;
 extern const struct attribute_group ra_net_attr_group;
 
+int ra_net_pp_stats_init(struct ra_net_priv *priv);
+void ra_net_pp_stats_reset(struct ra_net_priv *priv, u32 mask);
+
 int ra_net_phylink_init(struct ra_net_priv *priv);
 int ra_net_mdio_init(struct ra_net_priv *priv);
 
@@ -150,6 +284,14 @@ void ra_net_rx_read_timestamp(struct ra_net_priv *priv, struct sk_buff *skb);
 void ra_net_rx_apply_timestamp(struct ra_net_priv *priv, struct sk_buff *skb,
 			       struct ptp_packet_fpga_timestamp *ts);
 
+int ra_net_rx_class_init(struct ra_net_priv *priv);
+void ra_net_rx_account(struct ra_net_priv *priv, const struct sk_buff *skb,
+		       unsigned int len);
+void ra_net_rx_class_read(struct ra_net_priv *priv, enum ra_net_rx_class class,
+			  u64 *packets, u64 *bytes);
+
+void ra_net_debugfs_init(struct ra_net_priv *priv);
+
 int ra_net_dma_probe(struct ra_net_priv *priv);
 void ra_net_dma_flush(struct ra_net_priv *priv);
 void ra_net_dma_rx(struct ra_net_priv *priv);
@@ -89,6 +89,8 @@
 #define RA_NET_PP_CNT_TX_STREAM_LOST		0x042c
 
 #define RA_NET_PP_CNT_UDP_FILTER_CTRL		0x0430
+#define RA_NET_PP_CNT_UDP_FILTER_CTRL_EN	BIT(31)
+#define RA_NET_PP_CNT_UDP_FILTER_CTRL_PORT_MASK	0x0000ffff
 #define RA_NET_PP_CNT_UDP_THROTTLE		0x0434
 
 #define RA_NET_RTP_GLOBAL_OFFSET		0x0438
@@ -63,7 +63,7 @@ static ssize_t counter_reset_store(struct device *dev,
 	if (ret < 0)
 		return ret;
 
-	ra_net_iow(priv, RA_NET_PP_CNT_RST, v);
+	ra_net_pp_stats_reset(priv, v);
 
 	return count;
 }
@@ -76,10 +76,10 @@ static ssize_t udp_filter_port_show(struct device *dev,
 	struct ra_net_priv *priv = netdev_priv(to_net_dev(dev));
 	u32 v = ra_net_ior(priv, RA_NET_PP_CNT_UDP_FILTER_CTRL);
 
-	if (!(v & BIT(31)))
+	if (!(v & RA_NET_PP_CNT_UDP_FILTER_CTRL_EN))
 		v = 0;
 
-	v &= 0xffff;
+	v &= RA_NET_PP_CNT_UDP_FILTER_CTRL_PORT_MASK;
 
 	return sysfs_emit(buf, "%d\n", v);
 }
@@ -96,11 +96,11 @@ static ssize_t udp_filter_port_store(struct device *dev,
 	if (ret < 0)
 		return ret;
 
-	if (v > 0xffff)
+	if (v > RA_NET_PP_CNT_UDP_FILTER_CTRL_PORT_MASK)
 		return -EINVAL;
 
 	if (v > 0)
-		v |= BIT(31);
+		v |= RA_NET_PP_CNT_UDP_FILTER_CTRL_EN;
 
 	ra_net_iow(priv, RA_NET_PP_CNT_UDP_FILTER_CTRL, v);
 
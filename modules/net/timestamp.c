@@ -8,6 +8,7 @@
 #include <uapi/linux/net_tstamp.h>
 
 #include "main.h"
+#include "trace.h"
 
 void ra_net_tx_ts_irq(struct ra_net_priv *priv)
 {
@@ -100,6 +101,9 @@ static void ra_net_stamp_tx_skb(struct ra_net_priv *priv, struct sk_buff *skb,
 
 	packet_seq_id = ntohs(*(__be16*)(data + offset + OFF_PTP_SEQUENCE_ID));
 
+	trace_ra_net_tx_ts(priv->ndev, ts->sequence_id, packet_seq_id,
+			   ts->sequence_id == packet_seq_id);
+
 	if (likely(ts->sequence_id == packet_seq_id)) {
 		/* OK, timestamp is valid */
 		u64 seconds;
@@ -311,7 +315,7 @@ void ra_net_rx_read_timestamp(struct ra_net_priv *priv, struct sk_buff *skb)
 
 	BUILD_BUG_ON(!IS_ALIGNED(sizeof(ts), sizeof(u32)));
 
-	ra_net_ior_rep(priv, RA_NET_RX_FIFO, &ts, sizeof(ts));
+	ra_net_fifo_read(priv, &ts, sizeof(ts));
 	ra_net_rx_apply_timestamp(priv, skb, &ts);
 }
 
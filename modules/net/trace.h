@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ravenna_net
+
+#if !defined(RA_NET_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define RA_NET_TRACE_H
+
+#include <linux/netdevice.h>
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+#ifndef ra_net_trace_assign_name
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define ra_net_trace_assign_name(ndev)	__assign_str(name)
+#else
+#define ra_net_trace_assign_name(ndev)	__assign_str(name, (ndev)->name)
+#endif
+#endif
+
+TRACE_EVENT(ra_net_irq,
+	TP_PROTO(const struct net_device *ndev, u32 irqs, u32 pp_irqs),
+	TP_ARGS(ndev, irqs, pp_irqs),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+		__field(u32, irqs)
+		__field(u32, pp_irqs)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+		__entry->irqs = irqs;
+		__entry->pp_irqs = pp_irqs;
+	),
+	TP_printk("%s irqs=0x%04x pp_irqs=0x%04x",
+		  __get_str(name), __entry->irqs, __entry->pp_irqs)
+);
+
+TRACE_EVENT(ra_net_napi_poll,
+	TP_PROTO(const struct net_device *ndev, int count, int budget),
+	TP_ARGS(ndev, count, budget),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+		__field(int, count)
+		__field(int, budget)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+		__entry->count = count;
+		__entry->budget = budget;
+	),
+	TP_printk("%s count=%d budget=%d",
+		  __get_str(name), __entry->count, __entry->budget)
+);
+
+TRACE_EVENT(ra_net_rx_packet,
+	TP_PROTO(const struct net_device *ndev, u32 len, bool timestamped),
+	TP_ARGS(ndev, len, timestamped),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+		__field(u32, len)
+		__field(bool, timestamped)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+		__entry->len = len;
+		__entry->timestamped = timestamped;
+	),
+	TP_printk("%s len=%u timestamped=%d",
+		  __get_str(name), __entry->len, __entry->timestamped)
+);
+
+DECLARE_EVENT_CLASS(ra_net_dma_template,
+	TP_PROTO(const struct net_device *ndev, size_t len, bool timestamped),
+	TP_ARGS(ndev, len, timestamped),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+		__field(size_t, len)
+		__field(bool, timestamped)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+		__entry->len = len;
+		__entry->timestamped = timestamped;
+	),
+	TP_printk("%s len=%zu timestamped=%d",
+		  __get_str(name), __entry->len, __entry->timestamped)
+);
+
+DEFINE_EVENT(ra_net_dma_template, ra_net_dma_submit,
+	TP_PROTO(const struct net_device *ndev, size_t len, bool timestamped),
+	TP_ARGS(ndev, len, timestamped)
+);
+
+DEFINE_EVENT(ra_net_dma_template, ra_net_dma_complete,
+	TP_PROTO(const struct net_device *ndev, size_t len, bool timestamped),
+	TP_ARGS(ndev, len, timestamped)
+);
+
+TRACE_EVENT(ra_net_tx_enqueue,
+	TP_PROTO(const struct net_device *ndev, u32 len, u32 free,
+		 bool throttled),
+	TP_ARGS(ndev, len, free, throttled),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+		__field(u32, len)
+		__field(u32, free)
+		__field(bool, throttled)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+		__entry->len = len;
+		__entry->free = free;
+		__entry->throttled = throttled;
+	),
+	TP_printk("%s len=%u free=%u throttled=%d",
+		  __get_str(name), __entry->len, __entry->free,
+		  __entry->throttled)
+);
+
+TRACE_EVENT(ra_net_tx_ts,
+	TP_PROTO(const struct net_device *ndev, u16 ts_seq_id, u16 pkt_seq_id,
+		 bool match),
+	TP_ARGS(ndev, ts_seq_id, pkt_seq_id, match),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+		__field(u16, ts_seq_id)
+		__field(u16, pkt_seq_id)
+		__field(bool, match)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+		__entry->ts_seq_id = ts_seq_id;
+		__entry->pkt_seq_id = pkt_seq_id;
+		__entry->match = match;
+	),
+	TP_printk("%s %s ts_seq_id=0x%04x pkt_seq_id=0x%04x",
+		  __get_str(name), __entry->match ? "match" : "miss",
+		  __entry->ts_seq_id, __entry->pkt_seq_id)
+);
+
+TRACE_EVENT(ra_net_reset,
+	TP_PROTO(const struct net_device *ndev),
+	TP_ARGS(ndev),
+	TP_STRUCT__entry(
+		__string(name, ndev->name)
+	),
+	TP_fast_assign(
+		ra_net_trace_assign_name(ndev);
+	),
+	TP_printk("%s", __get_str(name))
+);
+
+#endif /* RA_NET_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>
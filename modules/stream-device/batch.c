@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "main.h"
+
+int ra_sd_batch_validate_op(struct ra_sd_priv *priv,
+			    const struct ra_sd_batch_op *op)
+{
+	switch (op->op) {
+	case RA_SD_BATCH_OP_ADD_RX_STREAM:
+	case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+		return ra_sd_rx_validate_stream(&priv->rx, &op->rx);
+
+	case RA_SD_BATCH_OP_ADD_TX_STREAM:
+	case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+		return ra_sd_tx_validate_stream(&priv->tx, &op->tx);
+
+	case RA_SD_BATCH_OP_DELETE_RX_STREAM:
+	case RA_SD_BATCH_OP_DELETE_TX_STREAM:
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/* Must be called with both rx->mutex and tx->mutex held */
+static int ra_sd_batch_apply_op(struct ra_sd_priv *priv, struct file *filp,
+				struct ra_sd_batch_op *op)
+{
+	int ret;
+
+	switch (op->op) {
+	case RA_SD_BATCH_OP_ADD_RX_STREAM:
+		ret = ra_sd_rx_add_stream(&priv->rx, filp, &op->rx);
+		break;
+
+	case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+		return ra_sd_rx_update_stream(&priv->rx, filp, op->index,
+					      &op->rx);
+
+	case RA_SD_BATCH_OP_DELETE_RX_STREAM:
+		return ra_sd_rx_delete_stream(&priv->rx, filp, op->index);
+
+	case RA_SD_BATCH_OP_ADD_TX_STREAM:
+		ret = ra_sd_tx_add_stream(&priv->tx, filp, &op->tx);
+		break;
+
+	case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+		return ra_sd_tx_update_stream(&priv->tx, filp, op->index,
+					      &op->tx);
+
+	case RA_SD_BATCH_OP_DELETE_TX_STREAM:
+		return ra_sd_tx_delete_stream(&priv->tx, filp, op->index);
+
+	default:
+		return -EINVAL;
+	}
+
+	if (ret < 0)
+		return ret;
+
+	op->index = ret;
+
+	return 0;
+}
+
+/*
+ * Applies a vector of stream operations. All operations are validated
+ * before any of them is applied, so a malformed batch leaves the hardware
+ * untouched. The valid operations are then applied in order under a single
+ * hold of the RX and TX locks (always taken in that order).
+ *
+ * Returns the number of operations that failed to apply, or a negative
+ * errno if the batch was rejected as a whole. In both cases, the per-op
+ * results and indices are written back to userspace.
+ */
+int ra_sd_batch_ioctl(struct ra_sd_priv *priv, struct file *filp,
+		      unsigned int size, void __user *buf)
+{
+	struct ra_sd_batch_op __user *uops;
+	struct ra_sd_batch_op *ops;
+	struct ra_sd_batch_cmd cmd;
+	int i, ret = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.num_ops > RA_SD_BATCH_MAX_OPS)
+		return -EINVAL;
+
+	if (cmd.num_ops == 0)
+		return 0;
+
+	uops = u64_to_user_ptr(cmd.ops);
+	ops = vmemdup_user(uops, array_size(cmd.num_ops, sizeof(*ops)));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	for (i = 0; i < cmd.num_ops; i++) {
+		ops[i].result = ra_sd_batch_validate_op(priv, &ops[i]);
+		if (ops[i].result < 0)
+			ret = -EINVAL;
+	}
+
+	if (ret < 0)
+		goto out_copy;
+
+	mutex_lock(&priv->rx.mutex);
+	mutex_lock(&priv->tx.mutex);
+
+	for (i = 0; i < cmd.num_ops; i++) {
+		ops[i].result = ra_sd_batch_apply_op(priv, filp, &ops[i]);
+		if (ops[i].result < 0)
+			ret++;
+	}
+
+	mutex_unlock(&priv->tx.mutex);
+	mutex_unlock(&priv->rx.mutex);
+
+	dev_dbg(priv->dev, "Applied batch of %u ops, %d failed\n",
+		cmd.num_ops, ret);
+
+out_copy:
+	for (i = 0; i < cmd.num_ops; i++) {
+		if (put_user(ops[i].index, &uops[i].index) ||
+		    put_user(ops[i].result, &uops[i].result)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	kvfree(ops);
+
+	return ret;
+}
+
+static int ra_sd_set_active_check(struct ra_sd_priv *priv, struct file *filp,
+				  const struct ra_sd_stream_active *a)
+{
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+
+	switch (a->direction) {
+	case RA_SD_DIRECTION_RX:
+		rxe = ra_sd_rx_stream_elem_find_by_index(&priv->rx, a->index);
+		if (!rxe)
+			return -ENOENT;
+
+		/* Streams can only be updated by their creators */
+		return rxe->filp == filp ? 0 : -EACCES;
+
+	case RA_SD_DIRECTION_TX:
+		txe = ra_sd_tx_stream_elem_find_by_index(&priv->tx, a->index);
+		if (!txe)
+			return -ENOENT;
+
+		return txe->filp == filp ? 0 : -EACCES;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Toggles the ACT bit of a list of streams. Only the control word of each
+ * stream table entry is written, and nothing is written unless all entries
+ * refer to streams owned by the caller.
+ */
+int ra_sd_set_active_ioctl(struct ra_sd_priv *priv, struct file *filp,
+			   unsigned int size, void __user *buf)
+{
+	struct ra_sd_stream_active *entries;
+	struct ra_sd_set_active_cmd cmd;
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+	int i, ret = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.num_entries > RA_SD_SET_ACTIVE_MAX_ENTRIES)
+		return -EINVAL;
+
+	if (cmd.num_entries == 0)
+		return 0;
+
+	entries = vmemdup_user(u64_to_user_ptr(cmd.entries),
+			       array_size(cmd.num_entries, sizeof(*entries)));
+	if (IS_ERR(entries))
+		return PTR_ERR(entries);
+
+	mutex_lock(&priv->rx.mutex);
+	mutex_lock(&priv->tx.mutex);
+
+	for (i = 0; i < cmd.num_entries; i++) {
+		ret = ra_sd_set_active_check(priv, filp, &entries[i]);
+		if (ret < 0)
+			goto out_unlock;
+	}
+
+	for (i = 0; i < cmd.num_entries; i++) {
+		const struct ra_sd_stream_active *a = &entries[i];
+
+		if (a->direction == RA_SD_DIRECTION_RX) {
+			rxe = ra_sd_rx_stream_elem_find_by_index(&priv->rx,
+								 a->index);
+			rxe->stream.active = a->active;
+			ra_stream_table_rx_set_active(&priv->rx.sttb,
+						      a->index, a->active);
+		} else {
+			txe = ra_sd_tx_stream_elem_find_by_index(&priv->tx,
+								 a->index);
+			txe->stream.active = a->active;
+			ra_stream_table_tx_set_active(&priv->tx.sttb,
+						      a->index, a->active);
+		}
+	}
+
+out_unlock:
+	mutex_unlock(&priv->tx.mutex);
+	mutex_unlock(&priv->rx.mutex);
+
+	kvfree(entries);
+
+	return ret;
+}
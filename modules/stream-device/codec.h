@@ -37,6 +37,23 @@ static inline u8 ra_sd_codec_fpga_code(int codec)
 	}
 }
 
+/* Reverse of ra_sd_codec_fpga_code(), for entries read back from the FPGA */
+static inline int ra_sd_codec_from_fpga_code(u8 code)
+{
+	switch (code) {
+	case 0xa8:
+		return RA_STREAM_CODEC_AM824;
+	case 0x20:
+		return RA_STREAM_CODEC_L32;
+	case 0x18:
+		return RA_STREAM_CODEC_L24;
+	case 0x10:
+		return RA_STREAM_CODEC_L16;
+	default:
+		return -EINVAL;
+	}
+}
+
 static inline int ra_sd_codec_sample_length(int codec)
 {
 	switch (codec) {
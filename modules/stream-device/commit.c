@@ -0,0 +1,736 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/bitmap.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "main.h"
+
+struct ra_sd_staged_op {
+	struct list_head	list;
+	struct ra_sd_batch_op	op;
+};
+
+/* Planned outcome of a single staged operation */
+struct ra_sd_commit_op {
+	const struct ra_sd_batch_op	*op;
+	void				*elem;
+	u32				index;
+	int				trtb_index;
+};
+
+struct ra_sd_commit {
+	struct ra_sd_priv	*priv;
+	struct file		*filp;
+
+	/* Snapshots of the allocation state, modified while planning */
+	unsigned long		*rx_entries;
+	unsigned long		*tx_entries;
+	unsigned long		*rx_tracks;
+	u64			tx_bps[2];
+
+	/* Streams referenced by updates and deletes */
+	unsigned long		*rx_seen;
+	unsigned long		*tx_seen;
+
+	struct ra_sd_commit_op	*ops;
+	unsigned int		num_ops;
+};
+
+void ra_sd_discard_staged(struct ra_sd_file *f)
+{
+	struct ra_sd_staged_op *s, *tmp;
+
+	list_for_each_entry_safe(s, tmp, &f->staged, list) {
+		list_del(&s->list);
+		kfree(s);
+	}
+
+	f->num_staged = 0;
+}
+
+int ra_sd_stage_ioctl(struct ra_sd_file *f, unsigned int size,
+		      void __user *buf)
+{
+	struct ra_sd_stage_cmd cmd;
+	struct ra_sd_staged_op *s;
+	int ret;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	ret = ra_sd_batch_validate_op(f->priv, &cmd.op);
+	if (ret < 0)
+		return ret;
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+
+	memcpy(&s->op, &cmd.op, sizeof(s->op));
+
+	mutex_lock(&f->mutex);
+
+	if (f->num_staged >= RA_SD_STAGE_MAX_OPS) {
+		mutex_unlock(&f->mutex);
+		kfree(s);
+		return -E2BIG;
+	}
+
+	list_add_tail(&s->list, &f->staged);
+	ret = f->num_staged++;
+
+	mutex_unlock(&f->mutex);
+
+	return ret;
+}
+
+int ra_sd_discard_ioctl(struct ra_sd_file *f, unsigned int size,
+			void __user *buf)
+{
+	struct ra_sd_discard_cmd cmd;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	mutex_lock(&f->mutex);
+	ra_sd_discard_staged(f);
+	mutex_unlock(&f->mutex);
+
+	return 0;
+}
+
+static void ra_sd_commit_free(struct ra_sd_commit *c)
+{
+	bitmap_free(c->rx_entries);
+	bitmap_free(c->tx_entries);
+	bitmap_free(c->rx_tracks);
+	bitmap_free(c->rx_seen);
+	bitmap_free(c->tx_seen);
+	kvfree(c->ops);
+}
+
+static int ra_sd_commit_init(struct ra_sd_commit *c, struct ra_sd_file *f,
+			     struct file *filp)
+{
+	struct ra_sd_priv *priv = f->priv;
+	struct ra_sd_staged_op *s;
+	int i = 0;
+
+	c->priv = priv;
+	c->filp = filp;
+	c->num_ops = f->num_staged;
+
+	c->ops = kvcalloc(c->num_ops, sizeof(*c->ops), GFP_KERNEL);
+	c->rx_entries = bitmap_zalloc(priv->rx.trtb.max_entries, GFP_KERNEL);
+	c->tx_entries = bitmap_zalloc(priv->tx.trtb.max_entries, GFP_KERNEL);
+	c->rx_tracks = bitmap_zalloc(priv->max_tracks, GFP_KERNEL);
+	c->rx_seen = bitmap_zalloc(priv->rx.sttb.max_entries, GFP_KERNEL);
+	c->tx_seen = bitmap_zalloc(priv->tx.sttb.max_entries, GFP_KERNEL);
+
+	if (!c->ops || !c->rx_entries || !c->tx_entries ||
+	    !c->rx_tracks || !c->rx_seen || !c->tx_seen) {
+		ra_sd_commit_free(c);
+		return -ENOMEM;
+	}
+
+	list_for_each_entry(s, &f->staged, list)
+		c->ops[i++].op = &s->op;
+
+	return 0;
+}
+
+/*
+ * First planning pass: look up the streams which are updated or deleted, and
+ * release the resources of deleted streams in the snapshots.
+ */
+static int ra_sd_commit_plan_lookup(struct ra_sd_commit *c,
+				    struct ra_sd_commit_op *o)
+{
+	struct ra_sd_rx *rx = &c->priv->rx;
+	struct ra_sd_tx *tx = &c->priv->tx;
+	const struct ra_sd_batch_op *op = o->op;
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+
+	o->index = op->index;
+
+	switch (op->op) {
+	case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+	case RA_SD_BATCH_OP_DELETE_RX_STREAM:
+		if (o->index >= rx->sttb.max_entries)
+			return -ENOENT;
+
+		rxe = ra_sd_rx_stream_elem_find_by_index(rx, o->index);
+		if (!rxe)
+			return -ENOENT;
+
+		if (rxe->filp != c->filp)
+			return -EACCES;
+
+		if (test_and_set_bit(o->index, c->rx_seen))
+			return -EINVAL;
+
+		o->elem = rxe;
+		o->trtb_index = rxe->trtb_index;
+
+		ra_sd_rx_tracks_mark_unused(c->rx_tracks, &rxe->stream);
+
+		if (op->op == RA_SD_BATCH_OP_DELETE_RX_STREAM)
+			bitmap_clear(c->rx_entries, rxe->trtb_index,
+				     rxe->stream.num_channels);
+		break;
+
+	case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+	case RA_SD_BATCH_OP_DELETE_TX_STREAM:
+		if (o->index >= tx->sttb.max_entries)
+			return -ENOENT;
+
+		txe = ra_sd_tx_stream_elem_find_by_index(tx, o->index);
+		if (!txe)
+			return -ENOENT;
+
+		if (txe->filp != c->filp)
+			return -EACCES;
+
+		if (test_and_set_bit(o->index, c->tx_seen))
+			return -EINVAL;
+
+		o->elem = txe;
+		o->trtb_index = txe->trtb_index;
+
+		if (op->op == RA_SD_BATCH_OP_DELETE_TX_STREAM) {
+			bitmap_clear(c->tx_entries, txe->trtb_index,
+				     txe->stream.num_channels);
+			ra_sd_tx_bandwidth_update(tx, c->tx_bps,
+						  &txe->stream, NULL);
+		}
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Second planning pass: reserve tracks, track table entries and stream
+ * indices for new and updated streams.
+ */
+static int ra_sd_commit_plan_reserve(struct ra_sd_commit *c,
+				     struct ra_sd_commit_op *o)
+{
+	struct ra_sd_rx *rx = &c->priv->rx;
+	struct ra_sd_tx *tx = &c->priv->tx;
+	const struct ra_sd_batch_op *op = o->op;
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+	int ret;
+
+	switch (op->op) {
+	case RA_SD_BATCH_OP_ADD_RX_STREAM:
+		ret = ra_sd_rx_tracks_available(rx, c->rx_tracks, &op->rx);
+		if (ret < 0)
+			return ret;
+
+		ra_sd_rx_tracks_mark_used(c->rx_tracks, &op->rx);
+
+		ret = ra_track_table_reserve(&rx->trtb, c->rx_entries,
+					     op->rx.num_channels);
+		if (ret < 0)
+			return ret;
+
+		o->trtb_index = ret;
+
+		rxe = kzalloc(sizeof(*rxe), GFP_KERNEL);
+		if (!rxe)
+			return -ENOMEM;
+
+		rxe->filp = c->filp;
+		rxe->pid = get_pid(task_pid(current));
+		rxe->trtb_index = o->trtb_index;
+		memcpy(&rxe->stream, &op->rx, sizeof(rxe->stream));
+
+		/*
+		 * Only reserve the index, the element is stored when the
+		 * commit is applied. Until then, lockless readers like the
+		 * RTCP scanner must not see it.
+		 */
+		ret = xa_alloc(&rx->streams, &o->index, NULL,
+			       XA_LIMIT(0, rx->sttb.max_entries-1), GFP_KERNEL);
+		if (ret < 0) {
+			put_pid(rxe->pid);
+			kfree(rxe);
+			return ret;
+		}
+
+		o->elem = rxe;
+		break;
+
+	case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+		rxe = o->elem;
+
+		ret = ra_sd_rx_tracks_available(rx, c->rx_tracks, &op->rx);
+		if (ret < 0)
+			return ret;
+
+		ra_sd_rx_tracks_mark_used(c->rx_tracks, &op->rx);
+
+		/* Shrinking is done in place, growing if possible */
+		if (rxe->stream.num_channels < op->rx.num_channels &&
+		    ra_track_table_grow(&rx->trtb, c->rx_entries,
+					rxe->trtb_index, rxe->stream.num_channels,
+					op->rx.num_channels) < 0) {
+			ret = ra_track_table_reserve(&rx->trtb, c->rx_entries,
+						     op->rx.num_channels);
+			if (ret < 0)
+				return ret;
+
+			o->trtb_index = ret;
+		}
+		break;
+
+	case RA_SD_BATCH_OP_ADD_TX_STREAM:
+		ret = ra_sd_tx_bandwidth_check(tx, c->tx_bps, NULL, &op->tx);
+		if (ret < 0)
+			return ret;
+
+		ra_sd_tx_bandwidth_update(tx, c->tx_bps, NULL, &op->tx);
+
+		ret = ra_track_table_reserve(&tx->trtb, c->tx_entries,
+					     op->tx.num_channels);
+		if (ret < 0)
+			return ret;
+
+		o->trtb_index = ret;
+
+		txe = kzalloc(sizeof(*txe), GFP_KERNEL);
+		if (!txe)
+			return -ENOMEM;
+
+		txe->filp = c->filp;
+		txe->pid = get_pid(task_pid(current));
+		txe->trtb_index = o->trtb_index;
+		memcpy(&txe->stream, &op->tx, sizeof(txe->stream));
+
+		/*
+		 * Only reserve the index, the element is stored when the
+		 * commit is applied. Until then, lockless readers like the
+		 * RTCP scanner must not see it.
+		 */
+		ret = xa_alloc(&tx->streams, &o->index, NULL,
+			       XA_LIMIT(0, tx->sttb.max_entries-1), GFP_KERNEL);
+		if (ret < 0) {
+			put_pid(txe->pid);
+			kfree(txe);
+			return ret;
+		}
+
+		o->elem = txe;
+		break;
+
+	case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+		txe = o->elem;
+
+		ret = ra_sd_tx_bandwidth_check(tx, c->tx_bps, &txe->stream,
+					       &op->tx);
+		if (ret < 0)
+			return ret;
+
+		ra_sd_tx_bandwidth_update(tx, c->tx_bps, &txe->stream, &op->tx);
+
+		/* Shrinking is done in place, growing if possible */
+		if (txe->stream.num_channels < op->tx.num_channels &&
+		    ra_track_table_grow(&tx->trtb, c->tx_entries,
+					txe->trtb_index, txe->stream.num_channels,
+					op->tx.num_channels) < 0) {
+			ret = ra_track_table_reserve(&tx->trtb, c->tx_entries,
+						     op->tx.num_channels);
+			if (ret < 0)
+				return ret;
+
+			o->trtb_index = ret;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Third planning pass: release the old track table entries of moved
+ * streams, or the tail of streams that shrink in place. This is done last
+ * so that entries which are still live until the stream table is rewritten
+ * are not handed out again by this commit.
+ */
+static void ra_sd_commit_plan_release(struct ra_sd_commit *c,
+				      struct ra_sd_commit_op *o)
+{
+	const struct ra_sd_batch_op *op = o->op;
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+
+	switch (op->op) {
+	case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+		rxe = o->elem;
+		if (o->trtb_index != rxe->trtb_index)
+			bitmap_clear(c->rx_entries, rxe->trtb_index,
+				     rxe->stream.num_channels);
+		else if (op->rx.num_channels < rxe->stream.num_channels)
+			bitmap_clear(c->rx_entries,
+				     rxe->trtb_index + op->rx.num_channels,
+				     rxe->stream.num_channels -
+				     op->rx.num_channels);
+		break;
+
+	case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+		txe = o->elem;
+		if (o->trtb_index != txe->trtb_index)
+			bitmap_clear(c->tx_entries, txe->trtb_index,
+				     txe->stream.num_channels);
+		else if (op->tx.num_channels < txe->stream.num_channels)
+			bitmap_clear(c->tx_entries,
+				     txe->trtb_index + op->tx.num_channels,
+				     txe->stream.num_channels -
+				     op->tx.num_channels);
+		break;
+	}
+}
+
+static int ra_sd_commit_plan(struct ra_sd_commit *c, int *failed)
+{
+	struct ra_sd_priv *priv = c->priv;
+	int i, ret;
+
+	bitmap_copy(c->rx_entries, priv->rx.trtb.used_entries,
+		    priv->rx.trtb.max_entries);
+	bitmap_copy(c->tx_entries, priv->tx.trtb.used_entries,
+		    priv->tx.trtb.max_entries);
+	bitmap_copy(c->rx_tracks, priv->rx.used_tracks, priv->max_tracks);
+	memcpy(c->tx_bps, priv->tx.used_bps, sizeof(c->tx_bps));
+
+	for (i = 0; i < c->num_ops; i++) {
+		ret = ra_sd_commit_plan_lookup(c, &c->ops[i]);
+		if (ret < 0)
+			goto out_failed;
+	}
+
+	for (i = 0; i < c->num_ops; i++) {
+		ret = ra_sd_commit_plan_reserve(c, &c->ops[i]);
+		if (ret < 0)
+			goto out_failed;
+	}
+
+	for (i = 0; i < c->num_ops; i++)
+		ra_sd_commit_plan_release(c, &c->ops[i]);
+
+	return 0;
+
+out_failed:
+	*failed = i;
+
+	return ret;
+}
+
+/* Undoes the stream index reservations of a failed plan */
+static void ra_sd_commit_rollback(struct ra_sd_commit *c)
+{
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+	int i;
+
+	for (i = 0; i < c->num_ops; i++) {
+		struct ra_sd_commit_op *o = &c->ops[i];
+
+		if (!o->elem)
+			continue;
+
+		switch (o->op->op) {
+		case RA_SD_BATCH_OP_ADD_RX_STREAM:
+			rxe = o->elem;
+			xa_release(&c->priv->rx.streams, o->index);
+			put_pid(rxe->pid);
+			kfree(rxe);
+			break;
+
+		case RA_SD_BATCH_OP_ADD_TX_STREAM:
+			txe = o->elem;
+			xa_release(&c->priv->tx.streams, o->index);
+			put_pid(txe->pid);
+			kfree(txe);
+			break;
+		}
+	}
+}
+
+/* Forgets the outcome of a failed plan, so that it can be planned again */
+static void ra_sd_commit_reset(struct ra_sd_commit *c)
+{
+	struct ra_sd_priv *priv = c->priv;
+	int i;
+
+	bitmap_zero(c->rx_seen, priv->rx.sttb.max_entries);
+	bitmap_zero(c->tx_seen, priv->tx.sttb.max_entries);
+
+	for (i = 0; i < c->num_ops; i++) {
+		c->ops[i].elem = NULL;
+		c->ops[i].index = 0;
+		c->ops[i].trtb_index = 0;
+	}
+}
+
+/*
+ * Compacts both track tables. Returns whether anything was moved, in which
+ * case a plan that failed with -ENOSPC may succeed now.
+ */
+static bool ra_sd_commit_defrag(struct ra_sd_commit *c)
+{
+	struct ra_sd_priv *priv = c->priv;
+	bool moved = false;
+
+	if (ra_sd_rx_defrag(&priv->rx) > 0)
+		moved = true;
+
+	if (ra_sd_tx_defrag(&priv->tx) > 0)
+		moved = true;
+
+	return moved;
+}
+
+/*
+ * Writes a successfully planned commit to the hardware. Deleted streams are
+ * torn down first, then the track tables of new and updated streams are
+ * filled, and only then are the stream table entries written, which sets
+ * VLD and EXEC_HASH last. Track table entries which are no longer used are
+ * muted at the very end.
+ */
+static void ra_sd_commit_apply(struct ra_sd_commit *c)
+{
+	struct ra_sd_priv *priv = c->priv;
+	struct ra_sd_rx *rx = &priv->rx;
+	struct ra_sd_tx *tx = &priv->tx;
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+	int i;
+
+	for (i = 0; i < c->num_ops; i++) {
+		struct ra_sd_commit_op *o = &c->ops[i];
+
+		switch (o->op->op) {
+		case RA_SD_BATCH_OP_DELETE_RX_STREAM:
+			rxe = o->elem;
+			ra_stream_table_rx_del(&rx->sttb, o->index);
+			ra_sd_rx_addrs_del(rx, rxe);
+			xa_erase(&rx->streams, o->index);
+			ra_sd_rtcp_rx_forget(priv, o->index);
+			put_pid(rxe->pid);
+			kfree(rxe);
+			break;
+
+		case RA_SD_BATCH_OP_DELETE_TX_STREAM:
+			txe = o->elem;
+			ra_stream_table_tx_del(&tx->sttb, o->index);
+			xa_erase(&tx->streams, o->index);
+			ra_sd_rtcp_tx_forget(priv, o->index);
+			put_pid(txe->pid);
+			kfree(txe);
+			break;
+		}
+	}
+
+	for (i = 0; i < c->num_ops; i++) {
+		struct ra_sd_commit_op *o = &c->ops[i];
+		const struct ra_sd_batch_op *op = o->op;
+
+		switch (op->op) {
+		case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+			rxe = o->elem;
+			if (rxe->trtb_index == o->trtb_index &&
+			    rxe->stream.num_channels == op->rx.num_channels) {
+				ra_track_table_update(&rx->trtb, o->trtb_index,
+						      op->rx.num_channels,
+						      rxe->stream.tracks,
+						      op->rx.tracks);
+				break;
+			}
+			fallthrough;
+
+		case RA_SD_BATCH_OP_ADD_RX_STREAM:
+			ra_track_table_set(&rx->trtb, o->trtb_index,
+					   op->rx.num_channels, op->rx.tracks);
+			break;
+
+		case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+			txe = o->elem;
+			if (txe->trtb_index == o->trtb_index &&
+			    txe->stream.num_channels == op->tx.num_channels) {
+				ra_track_table_update(&tx->trtb, o->trtb_index,
+						      op->tx.num_channels,
+						      txe->stream.tracks,
+						      op->tx.tracks);
+				break;
+			}
+			fallthrough;
+
+		case RA_SD_BATCH_OP_ADD_TX_STREAM:
+			ra_track_table_set(&tx->trtb, o->trtb_index,
+					   op->tx.num_channels, op->tx.tracks);
+			break;
+		}
+	}
+
+	for (i = 0; i < c->num_ops; i++) {
+		struct ra_sd_commit_op *o = &c->ops[i];
+		const struct ra_sd_batch_op *op = o->op;
+
+		switch (op->op) {
+		case RA_SD_BATCH_OP_UPDATE_RX_STREAM:
+			rxe = o->elem;
+			ra_sd_rx_addrs_del(rx, rxe);
+			memcpy(&rxe->stream, &op->rx, sizeof(rxe->stream));
+			rxe->trtb_index = o->trtb_index;
+			fallthrough;
+
+		case RA_SD_BATCH_OP_ADD_RX_STREAM:
+			rxe = o->elem;
+			ra_stream_table_rx_set(&rx->sttb, &rxe->stream,
+					       o->index, rxe->trtb_index);
+			ra_sd_rx_addrs_add(rx, rxe, o->index);
+
+			/* Fills the reserved slot, which cannot fail */
+			if (op->op == RA_SD_BATCH_OP_ADD_RX_STREAM)
+				xa_store(&rx->streams, o->index, rxe,
+					 GFP_KERNEL);
+			break;
+
+		case RA_SD_BATCH_OP_UPDATE_TX_STREAM:
+			txe = o->elem;
+			memcpy(&txe->stream, &op->tx, sizeof(txe->stream));
+			txe->trtb_index = o->trtb_index;
+			ra_stream_table_tx_set(&tx->sttb, &txe->stream,
+					       o->index, txe->trtb_index,
+					       ra_sd_tx_stream_ip_length(&txe->stream),
+					       false);
+			break;
+
+		case RA_SD_BATCH_OP_ADD_TX_STREAM:
+			txe = o->elem;
+			ra_stream_table_tx_set(&tx->sttb, &txe->stream,
+					       o->index, txe->trtb_index,
+					       ra_sd_tx_stream_ip_length(&txe->stream),
+					       true);
+
+			/* Fills the reserved slot, which cannot fail */
+			xa_store(&tx->streams, o->index, txe, GFP_KERNEL);
+			break;
+		}
+	}
+
+	ra_track_table_commit(&rx->trtb, c->rx_entries);
+	ra_track_table_commit(&tx->trtb, c->tx_entries);
+	bitmap_copy(rx->used_tracks, c->rx_tracks, priv->max_tracks);
+	memcpy(tx->used_bps, c->tx_bps, sizeof(tx->used_bps));
+}
+
+int ra_sd_commit_ioctl(struct ra_sd_file *f, struct file *filp,
+		       unsigned int size, void __user *buf)
+{
+	struct ra_sd_priv *priv = f->priv;
+	struct ra_sd_commit c = {};
+	struct ra_sd_commit_cmd cmd;
+	u32 __user *indices;
+	int i, ret, failed = -1;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	indices = u64_to_user_ptr(cmd.indices);
+
+	mutex_lock(&f->mutex);
+
+	if (f->num_staged == 0) {
+		ret = 0;
+		goto out_copy;
+	}
+
+	if (indices && cmd.num_indices < f->num_staged) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	ret = ra_sd_commit_init(&c, f, filp);
+	if (ret < 0)
+		goto out_unlock;
+
+	mutex_lock(&priv->rx.mutex);
+	mutex_lock(&priv->tx.mutex);
+
+	ret = ra_sd_commit_plan(&c, &failed);
+	if (ret < 0)
+		ra_sd_commit_rollback(&c);
+
+	/* The track tables may just be too fragmented */
+	if (ret == -ENOSPC && ra_sd_commit_defrag(&c)) {
+		ra_sd_commit_reset(&c);
+
+		ret = ra_sd_commit_plan(&c, &failed);
+		if (ret < 0)
+			ra_sd_commit_rollback(&c);
+	}
+
+	if (ret == 0)
+		ra_sd_commit_apply(&c);
+
+	mutex_unlock(&priv->tx.mutex);
+	mutex_unlock(&priv->rx.mutex);
+
+	if (ret < 0) {
+		dev_dbg(priv->dev, "Commit failed at staged op %d: %d\n",
+			failed, ret);
+		goto out_free;
+	}
+
+	dev_dbg(priv->dev, "Committed %u staged ops\n", c.num_ops);
+
+	if (indices) {
+		for (i = 0; i < c.num_ops; i++) {
+			if (put_user(c.ops[i].index, &indices[i])) {
+				ret = -EFAULT;
+				break;
+			}
+		}
+	}
+
+	/* The staging area is kept if the commit failed */
+	ra_sd_discard_staged(f);
+
+out_free:
+	ra_sd_commit_free(&c);
+
+out_copy:
+	cmd.failed_op = failed;
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+out_unlock:
+	mutex_unlock(&f->mutex);
+
+	return ret;
+}
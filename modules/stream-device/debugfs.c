@@ -117,6 +117,7 @@ static int ra_sd_tx_summary_show(struct seq_file *s, void *p)
 		   bitmap_weight(priv->tx.trtb.used_entries,
 				 priv->tx.trtb.max_entries),
 		   priv->tx.trtb.max_entries);
+	ra_track_table_show_free_runs(&priv->tx.trtb, s);
 
 	mutex_unlock(&priv->tx.mutex);
 
@@ -125,6 +126,21 @@ static int ra_sd_tx_summary_show(struct seq_file *s, void *p)
 
 DEFINE_SHOW_ATTRIBUTE(ra_sd_tx_summary);
 
+static int ra_sd_tx_defrag_set(void *data, u64 val)
+{
+	struct ra_sd_priv *priv = data;
+	int ret;
+
+	mutex_lock(&priv->tx.mutex);
+	ret = ra_sd_tx_defrag(&priv->tx);
+	mutex_unlock(&priv->tx.mutex);
+
+	return ret < 0 ? ret : 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(ra_sd_tx_defrag_fops, NULL,
+			 ra_sd_tx_defrag_set, "%llu\n");
+
 static void ra_sd_tx_print_interface(struct seq_file *s,
 				     struct ra_sd_tx_stream_interface *i,
 				     bool vlan)
@@ -239,6 +255,7 @@ static int ra_sd_rx_summary_show(struct seq_file *s, void *p)
 	seq_printf(s, "Tracks: %u/%u\n",
 		   bitmap_weight(priv->rx.used_tracks, priv->max_tracks),
 		   priv->max_tracks);
+	ra_track_table_show_free_runs(&priv->rx.trtb, s);
 
 	mutex_unlock(&priv->rx.mutex);
 
@@ -247,6 +264,21 @@ static int ra_sd_rx_summary_show(struct seq_file *s, void *p)
 
 DEFINE_SHOW_ATTRIBUTE(ra_sd_rx_summary);
 
+static int ra_sd_rx_defrag_set(void *data, u64 val)
+{
+	struct ra_sd_priv *priv = data;
+	int ret;
+
+	mutex_lock(&priv->rx.mutex);
+	ret = ra_sd_rx_defrag(&priv->rx);
+	mutex_unlock(&priv->rx.mutex);
+
+	return ret < 0 ? ret : 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(ra_sd_rx_defrag_fops, NULL,
+			 ra_sd_rx_defrag_set, "%llu\n");
+
 static int ra_sd_rx_streams_show(struct seq_file *s, void *p)
 {
 	struct ra_sd_priv *priv = s->private;
@@ -377,6 +409,7 @@ int ra_sd_debugfs_init(struct ra_sd_priv *priv)
 	debugfs_create_file("stream-table", 0444, rx, priv, &ra_sd_rx_stream_table_fops);
 	debugfs_create_file("track-table", 0444, rx, priv, &ra_sd_rx_track_table_fops);
 	debugfs_create_file("hash-table", 0444, rx, priv, &ra_sd_rx_hash_table_fops);
+	debugfs_create_file_unsafe("defrag", 0200, rx, priv, &ra_sd_rx_defrag_fops);
 
 	tx = debugfs_create_dir("tx", priv->debugfs);
 	if (IS_ERR(tx))
@@ -386,6 +419,7 @@ int ra_sd_debugfs_init(struct ra_sd_priv *priv)
 	debugfs_create_file("streams", 0444, tx, priv, &ra_sd_tx_streams_fops);
 	debugfs_create_file("stream-table", 0444, tx, priv, &ra_sd_tx_stream_table_fops);
 	debugfs_create_file("track-table", 0444, tx, priv, &ra_sd_tx_track_table_fops);
+	debugfs_create_file_unsafe("defrag", 0200, tx, priv, &ra_sd_tx_defrag_fops);
 
 	return 0;
 }
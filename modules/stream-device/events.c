@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/capability.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "main.h"
+
+/* Number of events copied to userspace per round, bounded by the stack */
+#define RA_SD_EVENTS_CHUNK	8
+
+/*
+ * Appends an event to the ring. Readers which fall behind by more than the
+ * size of the ring lose the oldest events, see ra_sd_events_read().
+ */
+static void ra_sd_event_emit(struct ra_sd_priv *priv,
+			     const struct ra_sd_event *ev)
+{
+	struct ra_sd_events *events = &priv->events;
+	unsigned long flags;
+
+	spin_lock_irqsave(&events->lock, flags);
+	events->ring[events->head & (RA_SD_EVENTS_RING_SIZE - 1)] = *ev;
+	events->head++;
+	spin_unlock_irqrestore(&events->lock, flags);
+
+	wake_up_interruptible(&events->wait);
+}
+
+static void ra_sd_event_emit_change(struct ra_sd_priv *priv, u64 now,
+				    u8 direction, u32 index, u32 type,
+				    u8 interface, u32 value, u32 old_value)
+{
+	struct ra_sd_event ev = {
+		.timestamp_ns	= now,
+		.type		= type,
+		.index		= index,
+		.direction	= direction,
+		.interface	= interface,
+		.value		= value,
+		.old_value	= old_value,
+	};
+
+	ra_sd_event_emit(priv, &ev);
+}
+
+static void
+ra_sd_events_rx_check_interface(struct ra_sd_priv *priv, u32 index, u64 now,
+				u8 interface,
+				const struct ra_sd_rtcp_rx_data_interface *old,
+				const struct ra_sd_rtcp_rx_data_interface *new)
+{
+	u32 late_threshold = READ_ONCE(priv->events.late_pkts_threshold);
+	u32 early_threshold = READ_ONCE(priv->events.early_pkts_threshold);
+	u16 delta;
+
+	if (new->playing != old->playing)
+		ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_RX, index,
+					RA_SD_EVENT_RX_PLAYING, interface,
+					new->playing, old->playing);
+
+	if (new->error != old->error)
+		ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_RX, index,
+					RA_SD_EVENT_RX_ERROR, interface,
+					new->error, old->error);
+
+	if (new->timeout_counter != old->timeout_counter)
+		ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_RX, index,
+					RA_SD_EVENT_RX_TIMEOUT, interface,
+					new->timeout_counter,
+					old->timeout_counter);
+
+	/* The packet counters are 16 bits wide and wrap */
+	delta = new->late_pkts - old->late_pkts;
+	if (late_threshold && delta >= late_threshold)
+		ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_RX, index,
+					RA_SD_EVENT_RX_LATE_PKTS, interface,
+					delta, 0);
+
+	delta = new->early_pkts - old->early_pkts;
+	if (early_threshold && delta >= early_threshold)
+		ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_RX, index,
+					RA_SD_EVENT_RX_EARLY_PKTS, interface,
+					delta, 0);
+}
+
+/*
+ * Compares two consecutive RTCP reads of an RX stream and raises events for
+ * the differences. Called from the RTCP interrupt handler.
+ */
+void ra_sd_events_rx_check(struct ra_sd_priv *priv, u32 index, u64 now,
+			   const struct ra_sd_rtcp_rx_data *old,
+			   const struct ra_sd_rtcp_rx_data *new)
+{
+	if (new->dev_state != old->dev_state)
+		ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_RX, index,
+					RA_SD_EVENT_RX_STATE, 0,
+					new->dev_state, old->dev_state);
+
+	ra_sd_events_rx_check_interface(priv, index, now,
+					RA_SD_INTERFACE_PRIMARY,
+					&old->primary, &new->primary);
+	ra_sd_events_rx_check_interface(priv, index, now,
+					RA_SD_INTERFACE_SECONDARY,
+					&old->secondary, &new->secondary);
+}
+
+static void
+ra_sd_events_tx_check_interface(struct ra_sd_priv *priv, u32 index, u64 now,
+				u8 interface, bool sending,
+				unsigned long *stalled,
+				const struct ra_sd_rtcp_tx_data_interface *old,
+				const struct ra_sd_rtcp_tx_data_interface *new)
+{
+	bool stall = sending && new->sent_pkts == old->sent_pkts;
+
+	if (stall == test_bit(index, stalled))
+		return;
+
+	assign_bit(index, stalled, stall);
+
+	ra_sd_event_emit_change(priv, now, RA_SD_DIRECTION_TX, index,
+				RA_SD_EVENT_TX_STALLED, interface,
+				stall, !stall);
+}
+
+/*
+ * Raises an event when an active interface of a TX stream stops or resumes
+ * sending packets. Called from the RTCP interrupt handler, with the RTCP scan
+ * lock held, which keeps @e alive.
+ */
+void ra_sd_events_tx_check(struct ra_sd_priv *priv, u32 index, u64 now,
+			   const struct ra_sd_tx_stream_elem *e,
+			   const struct ra_sd_rtcp_tx_data *old,
+			   const struct ra_sd_rtcp_tx_data *new)
+{
+	bool active = e->stream.active;
+
+	ra_sd_events_tx_check_interface(priv, index, now,
+					RA_SD_INTERFACE_PRIMARY,
+					active && e->stream.use_primary,
+					priv->events.tx_stalled[0],
+					&old->primary, &new->primary);
+	ra_sd_events_tx_check_interface(priv, index, now,
+					RA_SD_INTERFACE_SECONDARY,
+					active && e->stream.use_secondary,
+					priv->events.tx_stalled[1],
+					&old->secondary, &new->secondary);
+}
+
+/*
+ * Forgets the stall state of a TX stream which has been deleted. Called with
+ * the RTCP scan lock held.
+ */
+void ra_sd_events_tx_forget(struct ra_sd_priv *priv, u32 index)
+{
+	clear_bit(index, priv->events.tx_stalled[0]);
+	clear_bit(index, priv->events.tx_stalled[1]);
+}
+
+void ra_sd_events_open(struct ra_sd_priv *priv, struct ra_sd_file *f)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->events.lock, flags);
+	f->event_tail = priv->events.head;
+	spin_unlock_irqrestore(&priv->events.lock, flags);
+}
+
+static bool ra_sd_events_pending(struct ra_sd_priv *priv, struct ra_sd_file *f)
+{
+	unsigned long flags;
+	bool pending;
+
+	spin_lock_irqsave(&priv->events.lock, flags);
+	pending = f->event_tail != priv->events.head;
+	spin_unlock_irqrestore(&priv->events.lock, flags);
+
+	return pending;
+}
+
+/*
+ * Takes up to @max events of @f off the ring. If the reader has been
+ * overtaken, an overflow event which reports the number of lost events is
+ * returned first.
+ */
+static int ra_sd_events_take(struct ra_sd_priv *priv, struct ra_sd_file *f,
+			     struct ra_sd_event *ev, int max)
+{
+	struct ra_sd_events *events = &priv->events;
+	unsigned long flags;
+	u64 lost;
+	int n = 0;
+
+	spin_lock_irqsave(&events->lock, flags);
+
+	lost = events->head - f->event_tail;
+	if (lost > RA_SD_EVENTS_RING_SIZE) {
+		lost -= RA_SD_EVENTS_RING_SIZE;
+
+		memset(&ev[n], 0, sizeof(ev[n]));
+		ev[n].timestamp_ns = ktime_get_ns();
+		ev[n].type = RA_SD_EVENT_OVERFLOW;
+		ev[n].value = min_t(u64, lost, U32_MAX);
+		n++;
+
+		f->event_tail = events->head - RA_SD_EVENTS_RING_SIZE;
+	}
+
+	while (n < max && f->event_tail != events->head) {
+		ev[n++] = events->ring[f->event_tail &
+				      (RA_SD_EVENTS_RING_SIZE - 1)];
+		f->event_tail++;
+	}
+
+	spin_unlock_irqrestore(&events->lock, flags);
+
+	return n;
+}
+
+ssize_t ra_sd_events_read(struct ra_sd_priv *priv, struct file *filp,
+			  char __user *buf, size_t count)
+{
+	struct ra_sd_event ev[RA_SD_EVENTS_CHUNK];
+	struct ra_sd_file *f = filp->private_data;
+	size_t copied = 0;
+	int n, ret;
+
+	if (count < sizeof(*ev))
+		return -EINVAL;
+
+	for (;;) {
+		while (count - copied >= sizeof(*ev)) {
+			n = min_t(size_t, (count - copied) / sizeof(*ev),
+				  RA_SD_EVENTS_CHUNK);
+			n = ra_sd_events_take(priv, f, ev, n);
+			if (n == 0)
+				break;
+
+			if (copy_to_user(buf + copied, ev, n * sizeof(*ev)))
+				return copied ? copied : -EFAULT;
+
+			copied += n * sizeof(*ev);
+		}
+
+		if (copied)
+			return copied;
+
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(priv->events.wait,
+					       ra_sd_events_pending(priv, f));
+		if (ret < 0)
+			return ret;
+	}
+}
+
+__poll_t ra_sd_events_poll(struct ra_sd_priv *priv, struct file *filp,
+			   poll_table *wait)
+{
+	struct ra_sd_file *f = filp->private_data;
+
+	poll_wait(filp, &priv->events.wait, wait);
+
+	return ra_sd_events_pending(priv, f) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+int ra_sd_set_event_config_ioctl(struct ra_sd_priv *priv, unsigned int size,
+				 void __user *buf)
+{
+	struct ra_sd_set_event_config_cmd cmd;
+
+	/* The thresholds apply to all readers */
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.late_pkts_threshold > U16_MAX ||
+	    cmd.early_pkts_threshold > U16_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(priv->events.late_pkts_threshold, cmd.late_pkts_threshold);
+	WRITE_ONCE(priv->events.early_pkts_threshold, cmd.early_pkts_threshold);
+
+	return 0;
+}
+
+int ra_sd_events_probe(struct ra_sd_priv *priv)
+{
+	struct ra_sd_events *events = &priv->events;
+
+	spin_lock_init(&events->lock);
+	init_waitqueue_head(&events->wait);
+
+	events->ring = devm_kcalloc(priv->dev, RA_SD_EVENTS_RING_SIZE,
+				    sizeof(*events->ring), GFP_KERNEL);
+	if (!events->ring)
+		return -ENOMEM;
+
+	events->tx_stalled[0] = devm_bitmap_zalloc(priv->dev,
+						   priv->tx.sttb.max_entries,
+						   GFP_KERNEL);
+	events->tx_stalled[1] = devm_bitmap_zalloc(priv->dev,
+						   priv->tx.sttb.max_entries,
+						   GFP_KERNEL);
+	if (!events->tx_stalled[0] || !events->tx_stalled[1])
+		return -ENOMEM;
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/capability.h>
+#include <linux/file.h>
+#include <linux/random.h>
+#include <linux/uaccess.h>
+
+#include "main.h"
+
+/*
+ * Returns the handover token of @f, which is generated on first use. Tokens
+ * are random, so that they cannot be guessed by other processes.
+ */
+static u64 ra_sd_detach_token(struct ra_sd_file *f)
+{
+	lockdep_assert_held(&f->mutex);
+
+	while (!f->detach_token || f->detach_token == RA_SD_TOKEN_ADOPTED)
+		f->detach_token = get_random_u64();
+
+	return f->detach_token;
+}
+
+int ra_sd_detach_streams_ioctl(struct ra_sd_file *f, struct file *filp,
+			       unsigned int size, void __user *buf)
+{
+	struct ra_sd_priv *priv = f->priv;
+	struct ra_sd_detach_streams_cmd cmd;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.flags & ~(RA_SD_DETACH_ON_CLOSE | RA_SD_DETACH_CANCEL))
+		return -EINVAL;
+
+	cmd.num_rx_streams = 0;
+	cmd.num_tx_streams = 0;
+
+	mutex_lock(&f->mutex);
+
+	cmd.token = ra_sd_detach_token(f);
+
+	if (cmd.flags & RA_SD_DETACH_CANCEL) {
+		f->detach_on_close = false;
+	} else if (cmd.flags & RA_SD_DETACH_ON_CLOSE) {
+		f->detach_on_close = true;
+	} else {
+		cmd.num_rx_streams =
+			ra_sd_rx_transfer_streams(&priv->rx, filp, 0,
+						  NULL, cmd.token);
+		cmd.num_tx_streams =
+			ra_sd_tx_transfer_streams(&priv->tx, filp, 0,
+						  NULL, cmd.token);
+	}
+
+	mutex_unlock(&f->mutex);
+
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
+int ra_sd_adopt_streams_ioctl(struct ra_sd_file *f, struct file *filp,
+			      unsigned int size, void __user *buf)
+{
+	struct ra_sd_priv *priv = f->priv;
+	struct ra_sd_adopt_streams_cmd cmd;
+	struct ra_sd_file *other;
+	struct file *from;
+	u64 token;
+	int ret = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.flags & ~RA_SD_ADOPT_FROM_FD)
+		return -EINVAL;
+
+	if (cmd.flags & RA_SD_ADOPT_FROM_FD) {
+		/* The reference keeps the other file from being released */
+		from = fget(cmd.fd);
+		if (!from)
+			return -EBADF;
+
+		other = from->private_data;
+
+		if (from == filp || from->f_op != filp->f_op ||
+		    other->priv != priv) {
+			ret = -EINVAL;
+			goto out_put;
+		}
+
+		token = 0;
+	} else {
+		if (cmd.token == 0)
+			return -EINVAL;
+
+		/* This token is well known, unlike those of detached files */
+		if (cmd.token == RA_SD_TOKEN_ADOPTED && !capable(CAP_NET_ADMIN))
+			return -EPERM;
+
+		from = NULL;
+		token = cmd.token;
+	}
+
+	cmd.num_rx_streams =
+		ra_sd_rx_transfer_streams(&priv->rx, from, token, filp, 0);
+	cmd.num_tx_streams =
+		ra_sd_tx_transfer_streams(&priv->tx, from, token, filp, 0);
+
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+out_put:
+	if (from)
+		fput(from);
+
+	return ret;
+}
+
+/*
+ * Called when @filp is closed. Its streams are deleted, or detached if
+ * RA_SD_DETACH_ON_CLOSE has been requested.
+ */
+void ra_sd_release_streams(struct ra_sd_file *f, struct file *filp)
+{
+	struct ra_sd_priv *priv = f->priv;
+	u64 token = f->detach_token;
+
+	/* No other users of the file are left */
+	if (f->detach_on_close) {
+		ra_sd_rx_transfer_streams(&priv->rx, filp, 0, NULL, token);
+		ra_sd_tx_transfer_streams(&priv->tx, filp, 0, NULL, token);
+	} else {
+		ra_sd_rx_delete_streams(&priv->rx, filp);
+		ra_sd_tx_delete_streams(&priv->tx, filp);
+	}
+}
+
+/*
+ * In adopt mode, detached streams are left running for the next instance of
+ * the driver.
+ */
+static void ra_sd_delete_detached_streams(void *data)
+{
+	struct ra_sd_priv *priv = data;
+
+	if (priv->adopt) {
+		ra_sd_rx_abandon_streams(&priv->rx);
+		ra_sd_tx_abandon_streams(&priv->tx);
+	} else {
+		ra_sd_rx_delete_streams(&priv->rx, NULL);
+		ra_sd_tx_delete_streams(&priv->tx, NULL);
+	}
+}
+
+/*
+ * Detached streams outlive all files. Must be set up after the RTCP scanner,
+ * so that they are deleted before it is torn down.
+ */
+int ra_sd_handover_probe(struct ra_sd_priv *priv)
+{
+	int ret;
+
+	ret = devm_add_action_or_reset(priv->dev,
+				       ra_sd_delete_detached_streams, priv);
+	if (ret < 0)
+		return ret;
+
+	if (!priv->adopt)
+		return 0;
+
+	ret = ra_sd_rx_adopt_streams(&priv->rx);
+	if (ret < 0)
+		return ret;
+
+	return ra_sd_tx_adopt_streams(&priv->tx);
+}
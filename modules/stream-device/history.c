@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/capability.h>
+#include <linux/math64.h>
+#include <linux/overflow.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+
+#include "main.h"
+
+#define RA_SD_HISTORY_DEFAULT_BUCKETS	60
+#define RA_SD_HISTORY_DEFAULT_BUCKET_MS	1000
+
+struct ra_sd_history_acc {
+	s32	min;
+	s32	max;
+	s64	sum;
+};
+
+struct ra_sd_history_bucket_interface {
+	struct ra_sd_history_acc	estimated_jitter;
+	struct ra_sd_history_acc	peak_jitter;
+	struct ra_sd_history_acc	buffer_margin_min;
+	struct ra_sd_history_acc	buffer_margin_max;
+
+	u32				late_pkts;
+	u32				early_pkts;
+	u32				misordered_pkts;
+};
+
+struct ra_sd_history_bucket {
+	/* Number of RTCP reads folded into the bucket */
+	u32					count;
+
+	struct ra_sd_history_acc		path_differential;
+	struct ra_sd_history_bucket_interface	primary, secondary;
+};
+
+/* Rolling window of one RX stream */
+struct ra_sd_history_stream {
+	/* Last RTCP read folded in, for the packet counter deltas */
+	u64				last_timestamp;
+	struct ra_sd_rtcp_rx_data	last;
+
+	/* Time the window was created */
+	u64				created;
+
+	/* Current bucket and the time it started */
+	u32				head;
+	u64				bucket_start;
+
+	struct ra_sd_history_bucket	buckets[];
+};
+
+static void ra_sd_history_acc_add(struct ra_sd_history_acc *acc, u32 count,
+				  s32 value)
+{
+	if (count == 0 || value < acc->min)
+		acc->min = value;
+
+	if (count == 0 || value > acc->max)
+		acc->max = value;
+
+	acc->sum += value;
+}
+
+static void
+ra_sd_history_add_interface(struct ra_sd_history_bucket_interface *b,
+			    u32 count, bool delta,
+			    const struct ra_sd_rtcp_rx_data_interface *old,
+			    const struct ra_sd_rtcp_rx_data_interface *new)
+{
+	ra_sd_history_acc_add(&b->estimated_jitter, count,
+			      new->estimated_jitter);
+	ra_sd_history_acc_add(&b->peak_jitter, count, new->peak_jitter);
+	ra_sd_history_acc_add(&b->buffer_margin_min, count,
+			      new->buffer_margin_min);
+	ra_sd_history_acc_add(&b->buffer_margin_max, count,
+			      new->buffer_margin_max);
+
+	if (!delta)
+		return;
+
+	/* The packet counters are 16 bits wide and wrap */
+	b->late_pkts += (u16)(new->late_pkts - old->late_pkts);
+	b->early_pkts += (u16)(new->early_pkts - old->early_pkts);
+	b->misordered_pkts += (u16)(new->misordered_pkts -
+				    old->misordered_pkts);
+}
+
+/* Moves the head forward to the bucket covering @now */
+static void ra_sd_history_advance(struct ra_sd_priv *priv,
+				  struct ra_sd_history_stream *h, u64 now)
+{
+	u64 bucket_ns = (u64)priv->history.bucket_ms * NSEC_PER_MSEC;
+	u32 num_buckets = priv->history.num_buckets;
+	u64 n;
+
+	if (now - h->bucket_start < bucket_ns)
+		return;
+
+	n = div64_u64(now - h->bucket_start, bucket_ns);
+	h->bucket_start += n * bucket_ns;
+
+	/* Buckets which are skipped over did not see any reads */
+	for (n = min_t(u64, n, num_buckets); n > 0; n--) {
+		h->head = (h->head + 1) % num_buckets;
+		memset(&h->buckets[h->head], 0, sizeof(h->buckets[h->head]));
+	}
+}
+
+static struct ra_sd_history_stream *
+ra_sd_history_get(struct ra_sd_priv *priv, unsigned long index, u64 now)
+{
+	struct ra_sd_history_stream *h;
+
+	h = xa_load(&priv->history.streams, index);
+	if (h)
+		return h;
+
+	h = kvzalloc(struct_size(h, buckets, priv->history.num_buckets),
+		     GFP_KERNEL);
+	if (!h)
+		return NULL;
+
+	h->created = now;
+	h->bucket_start = now;
+
+	if (xa_err(xa_store(&priv->history.streams, index, h, GFP_KERNEL))) {
+		kvfree(h);
+		return NULL;
+	}
+
+	return h;
+}
+
+/*
+ * Folds the RTCP reads which happened since the last call into the windows
+ * of all RX streams. Called periodically from the RTCP work.
+ */
+void ra_sd_history_update(struct ra_sd_priv *priv)
+{
+	struct ra_sd_rx_stream_elem *e;
+	struct ra_sd_history_stream *h;
+	struct ra_sd_history_bucket *b;
+	struct ra_sd_rtcp_rx_data data;
+	unsigned long index;
+	u64 now, timestamp;
+	bool delta;
+
+	mutex_lock(&priv->history.mutex);
+
+	if (priv->history.num_buckets == 0)
+		goto out_unlock;
+
+	now = ktime_get_ns();
+
+	xa_for_each(&priv->rx.streams, index, e) {
+		timestamp = ra_sd_rtcp_rx_cached(priv, index, &data);
+		if (!timestamp)
+			continue;
+
+		h = ra_sd_history_get(priv, index, now);
+		if (!h)
+			continue;
+
+		ra_sd_history_advance(priv, h, now);
+
+		if (timestamp == h->last_timestamp)
+			continue;
+
+		b = &h->buckets[h->head];
+		delta = h->last_timestamp != 0;
+
+		ra_sd_history_acc_add(&b->path_differential, b->count,
+				      data.path_differential);
+		ra_sd_history_add_interface(&b->primary, b->count, delta,
+					    &h->last.primary, &data.primary);
+		ra_sd_history_add_interface(&b->secondary, b->count, delta,
+					    &h->last.secondary, &data.secondary);
+		b->count++;
+
+		h->last = data;
+		h->last_timestamp = timestamp;
+	}
+
+out_unlock:
+	mutex_unlock(&priv->history.mutex);
+}
+
+static void ra_sd_history_free_all(struct ra_sd_priv *priv)
+{
+	struct ra_sd_history_stream *h;
+	unsigned long index;
+
+	lockdep_assert_held(&priv->history.mutex);
+
+	xa_for_each(&priv->history.streams, index, h) {
+		xa_erase(&priv->history.streams, index);
+		kvfree(h);
+	}
+}
+
+/* Drops the window of a deleted RX stream */
+void ra_sd_history_forget(struct ra_sd_priv *priv, u32 index)
+{
+	mutex_lock(&priv->history.mutex);
+	kvfree(xa_erase(&priv->history.streams, index));
+	mutex_unlock(&priv->history.mutex);
+}
+
+static void ra_sd_history_stat_merge(struct ra_sd_history_stat *stat,
+				     s64 *sum, u32 count,
+				     const struct ra_sd_history_acc *acc)
+{
+	if (count == 0 || acc->min < stat->min)
+		stat->min = acc->min;
+
+	if (count == 0 || acc->max > stat->max)
+		stat->max = acc->max;
+
+	*sum += acc->sum;
+}
+
+struct ra_sd_history_sums {
+	s64	path_differential;
+	s64	iface[2][4];
+};
+
+static void
+ra_sd_history_merge_interface(struct ra_sd_rx_history_interface *out,
+			      s64 *sums, u32 count,
+			      const struct ra_sd_history_bucket_interface *b)
+{
+	ra_sd_history_stat_merge(&out->estimated_jitter, &sums[0], count,
+				 &b->estimated_jitter);
+	ra_sd_history_stat_merge(&out->peak_jitter, &sums[1], count,
+				 &b->peak_jitter);
+	ra_sd_history_stat_merge(&out->buffer_margin_min, &sums[2], count,
+				 &b->buffer_margin_min);
+	ra_sd_history_stat_merge(&out->buffer_margin_max, &sums[3], count,
+				 &b->buffer_margin_max);
+
+	out->late_pkts += b->late_pkts;
+	out->early_pkts += b->early_pkts;
+	out->misordered_pkts += b->misordered_pkts;
+}
+
+static void ra_sd_history_mean_interface(struct ra_sd_rx_history_interface *out,
+					 const s64 *sums, u32 count)
+{
+	out->estimated_jitter.mean = div_s64(sums[0], count);
+	out->peak_jitter.mean = div_s64(sums[1], count);
+	out->buffer_margin_min.mean = div_s64(sums[2], count);
+	out->buffer_margin_max.mean = div_s64(sums[3], count);
+}
+
+/* Aggregates the @n most recent buckets of @h, including the current one */
+static void ra_sd_history_aggregate(struct ra_sd_priv *priv,
+				    const struct ra_sd_history_stream *h,
+				    u32 n, u64 now,
+				    struct ra_sd_rx_history *out)
+{
+	u32 num_buckets = priv->history.num_buckets;
+	struct ra_sd_history_sums sums = {};
+	const struct ra_sd_history_bucket *b;
+	u32 i, count = 0;
+
+	for (i = 0; i < n; i++) {
+		b = &h->buckets[(h->head + num_buckets - i) % num_buckets];
+		if (b->count == 0)
+			continue;
+
+		ra_sd_history_stat_merge(&out->path_differential,
+					 &sums.path_differential, count,
+					 &b->path_differential);
+		ra_sd_history_merge_interface(&out->primary, sums.iface[0],
+					      count, &b->primary);
+		ra_sd_history_merge_interface(&out->secondary, sums.iface[1],
+					      count, &b->secondary);
+		count += b->count;
+	}
+
+	out->num_samples = count;
+	out->duration_ms = div_u64(min(now - h->created,
+				       (u64)(n - 1) * priv->history.bucket_ms *
+				       NSEC_PER_MSEC + now - h->bucket_start),
+				   NSEC_PER_MSEC);
+
+	if (count == 0)
+		return;
+
+	out->path_differential.mean = div_s64(sums.path_differential, count);
+	ra_sd_history_mean_interface(&out->primary, sums.iface[0], count);
+	ra_sd_history_mean_interface(&out->secondary, sums.iface[1], count);
+}
+
+int ra_sd_read_rx_history_ioctl(struct ra_sd_priv *priv, unsigned int size,
+				void __user *buf)
+{
+	struct ra_sd_read_rx_history_cmd cmd;
+	struct ra_sd_history_stream *h;
+	int ret = 0;
+	u64 now;
+	u32 n;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.index >= priv->rx.sttb.max_entries)
+		return -EINVAL;
+
+	memset(&cmd.history, 0, sizeof(cmd.history));
+
+	mutex_lock(&priv->history.mutex);
+
+	h = xa_load(&priv->history.streams, cmd.index);
+	if (!h) {
+		ret = xa_load(&priv->rx.streams, cmd.index) ? -ENODATA : -ENOENT;
+		goto out_unlock;
+	}
+
+	n = priv->history.num_buckets;
+	if (cmd.num_buckets != 0)
+		n = min(n, cmd.num_buckets);
+
+	now = ktime_get_ns();
+	ra_sd_history_advance(priv, h, now);
+	ra_sd_history_aggregate(priv, h, n, now, &cmd.history);
+
+	cmd.bucket_ms = priv->history.bucket_ms;
+
+out_unlock:
+	mutex_unlock(&priv->history.mutex);
+
+	if (ret < 0)
+		return ret;
+
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
+int ra_sd_set_history_config_ioctl(struct ra_sd_priv *priv, unsigned int size,
+				   void __user *buf)
+{
+	struct ra_sd_set_history_config_cmd cmd;
+
+	/* Discards the history of all clients */
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.num_buckets > RA_SD_HISTORY_MAX_BUCKETS)
+		return -EINVAL;
+
+	if (cmd.num_buckets != 0 &&
+	    (cmd.bucket_ms < RA_SD_HISTORY_MIN_BUCKET_MS ||
+	     cmd.bucket_ms > RA_SD_HISTORY_MAX_BUCKET_MS))
+		return -EINVAL;
+
+	mutex_lock(&priv->history.mutex);
+
+	/* Windows of the old geometry are of no use anymore */
+	ra_sd_history_free_all(priv);
+	priv->history.num_buckets = cmd.num_buckets;
+	priv->history.bucket_ms = cmd.bucket_ms;
+
+	mutex_unlock(&priv->history.mutex);
+
+	return 0;
+}
+
+static void ra_sd_history_destroy(void *data)
+{
+	struct ra_sd_priv *priv = data;
+
+	mutex_lock(&priv->history.mutex);
+	ra_sd_history_free_all(priv);
+	mutex_unlock(&priv->history.mutex);
+
+	xa_destroy(&priv->history.streams);
+}
+
+int ra_sd_history_probe(struct ra_sd_priv *priv)
+{
+	mutex_init(&priv->history.mutex);
+	xa_init(&priv->history.streams);
+
+	priv->history.num_buckets = RA_SD_HISTORY_DEFAULT_BUCKETS;
+	priv->history.bucket_ms = RA_SD_HISTORY_DEFAULT_BUCKET_MS;
+
+	return devm_add_action_or_reset(priv->dev, ra_sd_history_destroy, priv);
+}
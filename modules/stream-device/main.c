@@ -6,6 +6,11 @@
 #include <linux/of_platform.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#endif
 
 #include "main.h"
 
@@ -52,23 +57,88 @@ static int ra_sd_read_info_ioctl(struct ra_sd_priv *priv,
 	return 0;
 }
 
-static long ra_sd_ioctl(struct file *filp,
-			unsigned int cmd,
-			unsigned long arg)
+static int ra_sd_defrag_ioctl(struct ra_sd_priv *priv,
+			      unsigned int size,
+			      void __user *buf)
 {
-	struct ra_sd_priv *priv = to_ra_sd_priv(filp->private_data);
-	void __user *buf = (void __user *)arg;
+	struct ra_sd_defrag_cmd cmd;
+	int ret, moved = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.flags & ~(RA_SD_DEFRAG_RX | RA_SD_DEFRAG_TX))
+		return -EINVAL;
+
+	if (cmd.flags & RA_SD_DEFRAG_RX) {
+		mutex_lock(&priv->rx.mutex);
+		ret = ra_sd_rx_defrag(&priv->rx);
+		mutex_unlock(&priv->rx.mutex);
+
+		if (ret < 0)
+			return ret;
+
+		moved += ret;
+	}
+
+	if (cmd.flags & RA_SD_DEFRAG_TX) {
+		mutex_lock(&priv->tx.mutex);
+		ret = ra_sd_tx_defrag(&priv->tx);
+		mutex_unlock(&priv->tx.mutex);
+
+		if (ret < 0)
+			return ret;
+
+		moved += ret;
+	}
+
+	return moved;
+}
+
+/*
+ * Runs a command on behalf of ioctl() or io_uring. If @nowait is set, the
+ * command must not sleep and returns -EAGAIN instead.
+ */
+static long ra_sd_do_cmd(struct file *filp, unsigned int cmd,
+			 void __user *buf, bool nowait)
+{
+	struct ra_sd_file *f = filp->private_data;
+	struct ra_sd_priv *priv = f->priv;
 	unsigned int size = _IOC_SIZE(cmd);
 
+	switch (cmd) {
+	case RA_SD_READ_RTCP_RX_STAT:
+		return ra_sd_read_rtcp_rx_stat_ioctl(priv, size, buf, nowait);
+
+	case RA_SD_READ_RTCP_TX_STAT:
+		return ra_sd_read_rtcp_tx_stat_ioctl(priv, size, buf, nowait);
+	}
+
+	/* All other commands may sleep */
+	if (nowait)
+		return -EAGAIN;
+
 	switch (cmd) {
 	case RA_SD_READ_INFO:
 		return ra_sd_read_info_ioctl(priv, size, buf);
 
-	case RA_SD_READ_RTCP_RX_STAT:
-		return ra_sd_read_rtcp_rx_stat_ioctl(priv, size, buf);
+	case RA_SD_READ_RTCP_RX_STATS:
+		return ra_sd_read_rtcp_rx_stats_ioctl(priv, size, buf);
 
-	case RA_SD_READ_RTCP_TX_STAT:
-		return ra_sd_read_rtcp_tx_stat_ioctl(priv, size, buf);
+	case RA_SD_READ_RTCP_TX_STATS:
+		return ra_sd_read_rtcp_tx_stats_ioctl(priv, size, buf);
+
+	case RA_SD_READ_RX_HISTORY:
+		return ra_sd_read_rx_history_ioctl(priv, size, buf);
+
+	case RA_SD_SET_HISTORY_CONFIG:
+		return ra_sd_set_history_config_ioctl(priv, size, buf);
 
 	case RA_SD_ADD_TX_STREAM:
 		return ra_sd_tx_add_stream_ioctl(&priv->tx, filp, size, buf);
@@ -79,6 +149,13 @@ static long ra_sd_ioctl(struct file *filp,
 	case RA_SD_DELETE_TX_STREAM:
 		return ra_sd_tx_delete_stream_ioctl(&priv->tx, filp, size, buf);
 
+	case RA_SD_SET_TX_BANDWIDTH_CONFIG:
+		return ra_sd_tx_set_bandwidth_config_ioctl(&priv->tx, size,
+							   buf);
+
+	case RA_SD_READ_TX_BANDWIDTH:
+		return ra_sd_tx_read_bandwidth_ioctl(&priv->tx, size, buf);
+
 	case RA_SD_ADD_RX_STREAM:
 		return ra_sd_rx_add_stream_ioctl(&priv->rx, filp, size, buf);
 
@@ -87,24 +164,141 @@ static long ra_sd_ioctl(struct file *filp,
 
 	case RA_SD_DELETE_RX_STREAM:
 		return ra_sd_rx_delete_stream_ioctl(&priv->rx, filp, size, buf);
+
+	case RA_SD_BATCH:
+		return ra_sd_batch_ioctl(priv, filp, size, buf);
+
+	case RA_SD_STAGE:
+		return ra_sd_stage_ioctl(f, size, buf);
+
+	case RA_SD_COMMIT:
+		return ra_sd_commit_ioctl(f, filp, size, buf);
+
+	case RA_SD_DISCARD:
+		return ra_sd_discard_ioctl(f, size, buf);
+
+	case RA_SD_SET_ACTIVE:
+		return ra_sd_set_active_ioctl(priv, filp, size, buf);
+
+	case RA_SD_SET_ROUTES:
+		return ra_sd_set_routes_ioctl(priv, filp, size, buf);
+
+	case RA_SD_DEFRAG:
+		return ra_sd_defrag_ioctl(priv, size, buf);
+
+	case RA_SD_LIST_RX_STREAMS:
+		return ra_sd_rx_list_streams_ioctl(&priv->rx, size, buf);
+
+	case RA_SD_LIST_TX_STREAMS:
+		return ra_sd_tx_list_streams_ioctl(&priv->tx, size, buf);
+
+	case RA_SD_FIND_RX_STREAM:
+		return ra_sd_rx_find_stream_ioctl(&priv->rx, size, buf);
+
+	case RA_SD_DETACH_STREAMS:
+		return ra_sd_detach_streams_ioctl(f, filp, size, buf);
+
+	case RA_SD_ADOPT_STREAMS:
+		return ra_sd_adopt_streams_ioctl(f, filp, size, buf);
+
+	case RA_SD_SET_EVENT_CONFIG:
+		return ra_sd_set_event_config_ioctl(priv, size, buf);
 	}
 
 	return -ENOTTY;
 }
 
-static int ra_sd_release(struct inode *inode, struct file *filp)
+static long ra_sd_ioctl(struct file *filp,
+			unsigned int cmd,
+			unsigned long arg)
+{
+	return ra_sd_do_cmd(filp, cmd, (void __user *)arg, false);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+/*
+ * io_uring passthrough. The command opcode is the ioctl number, and the SQE
+ * carries a pointer to the same argument structure ioctl() takes. Commands
+ * which would sleep are retried by io_uring from a worker thread.
+ */
+static int ra_sd_uring_cmd(struct io_uring_cmd *ioucmd,
+			   unsigned int issue_flags)
+{
+	const struct ra_sd_uring_cmd *ucmd = io_uring_sqe_cmd(ioucmd->sqe);
+	void __user *buf = u64_to_user_ptr(READ_ONCE(ucmd->arg));
+
+	if (READ_ONCE(ucmd->reserved_0))
+		return -EINVAL;
+
+	return ra_sd_do_cmd(ioucmd->file, ioucmd->cmd_op, buf,
+			    issue_flags & IO_URING_F_NONBLOCK);
+}
+#endif
+
+static int ra_sd_open(struct inode *inode, struct file *filp)
 {
 	struct ra_sd_priv *priv = to_ra_sd_priv(filp->private_data);
+	struct ra_sd_file *f;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
 
-	ra_sd_rx_delete_streams(&priv->rx, filp);
-	ra_sd_tx_delete_streams(&priv->tx, filp);
+	f->priv = priv;
+	mutex_init(&f->mutex);
+	INIT_LIST_HEAD(&f->staged);
+	ra_sd_events_open(priv, f);
+
+	filp->private_data = f;
 
 	return 0;
 }
 
+static int ra_sd_release(struct inode *inode, struct file *filp)
+{
+	struct ra_sd_file *f = filp->private_data;
+
+	ra_sd_release_streams(f, filp);
+
+	ra_sd_discard_staged(f);
+	mutex_destroy(&f->mutex);
+	kfree(f);
+
+	return 0;
+}
+
+static ssize_t ra_sd_read(struct file *filp, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct ra_sd_file *f = filp->private_data;
+
+	return ra_sd_events_read(f->priv, filp, buf, count);
+}
+
+static __poll_t ra_sd_poll(struct file *filp, poll_table *wait)
+{
+	struct ra_sd_file *f = filp->private_data;
+
+	return ra_sd_events_poll(f->priv, filp, wait);
+}
+
+static int ra_sd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ra_sd_file *f = filp->private_data;
+
+	return ra_sd_stats_mmap(f->priv, vma);
+}
+
 static const struct file_operations ra_sd_fops =
 {
+	.open		= &ra_sd_open,
+	.read		= &ra_sd_read,
+	.poll		= &ra_sd_poll,
 	.unlocked_ioctl	= &ra_sd_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	.uring_cmd	= &ra_sd_uring_cmd,
+#endif
+	.mmap		= &ra_sd_mmap,
 	.release	= &ra_sd_release,
 };
 
@@ -125,11 +319,11 @@ static int ra_sd_probe(struct platform_device *pdev)
 	if (!priv)
 		return -ENOMEM;
 
-	mutex_init(&priv->rtcp_rx.mutex);
-	mutex_init(&priv->rtcp_tx.mutex);
+	spin_lock_init(&priv->rtcp_rx.scan.lock);
+	spin_lock_init(&priv->rtcp_tx.scan.lock);
 
-	init_waitqueue_head(&priv->rtcp_rx.wait);
-	init_waitqueue_head(&priv->rtcp_tx.wait);
+	init_waitqueue_head(&priv->rtcp_rx.scan.wait);
+	init_waitqueue_head(&priv->rtcp_tx.scan.wait);
 
 	priv->dev = dev;
 
@@ -153,24 +347,51 @@ static int ra_sd_probe(struct platform_device *pdev)
 		return -EINVAL;
 	}
 
-	if (priv->max_tracks > 256) {
+	/* Tracks are addressed with signed 16-bit values */
+	if (priv->max_tracks == 0 || priv->max_tracks > S16_MAX) {
 		dev_err(dev, "Unsupported number of tracks: %d\n",
 			priv->max_tracks);
 		return -EINVAL;
 	}
 
-	ret = ra_sd_rx_probe(&priv->rx, dev);
+	priv->adopt = of_property_read_bool(dev->of_node, "lawo,adopt-streams");
+
+	ret = ra_sd_rx_probe(&priv->rx, dev, priv->adopt);
 	if (ret < 0) {
 		dev_err(dev, "RX setup failed: %d\n", ret);
 		return ret;
 	}
 
-	ret = ra_sd_tx_probe(&priv->tx, dev);
+	ret = ra_sd_tx_probe(&priv->tx, dev, priv->adopt);
 	if (ret < 0) {
 		dev_err(dev, "TX setup failed: %d\n", ret);
 		return ret;
 	}
 
+	ret = ra_sd_stats_probe(priv);
+	if (ret < 0) {
+		dev_err(dev, "Statistics setup failed: %d\n", ret);
+		return ret;
+	}
+
+	ret = ra_sd_events_probe(priv);
+	if (ret < 0)
+		return ret;
+
+	ret = ra_sd_history_probe(priv);
+	if (ret < 0)
+		return ret;
+
+	ret = ra_sd_rtcp_probe(priv);
+	if (ret < 0) {
+		dev_err(dev, "RTCP setup failed: %d\n", ret);
+		return ret;
+	}
+
+	ret = ra_sd_handover_probe(priv);
+	if (ret < 0)
+		return ret;
+
 	ret = of_property_read_string(dev->of_node, "lawo,device-name", &name);
 	if (ret < 0) {
 		dev_err(dev, "No lawo,device-name property: %d\n", ret);
@@ -193,8 +414,9 @@ static int ra_sd_probe(struct platform_device *pdev)
 	if (ret < 0)
 		return ret;
 
-	/* Reset hash table */
-	ra_sd_iow(priv, RA_SD_RX_HSTB_CLEAR, 0);
+	/* Reset hash table, unless it holds the adopted streams */
+	if (!priv->adopt)
+		ra_sd_iow(priv, RA_SD_RX_HSTB_CLEAR, 0);
 
 	/* Reset counters */
 	ra_sd_iow(priv, RA_SD_COUNTER_RESET, ~0);
@@ -33,6 +33,23 @@
 #define RA_SD_RTCP_RX_DATA		0x100
 #define RA_SD_RTCP_TX_DATA		0x180
 
+/* Must be a power of 2 */
+#define RA_SD_EVENTS_RING_SIZE		1024
+
+struct ra_sd_events {
+	/* Protects the ring and the event_tail of all files */
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+	struct ra_sd_event	*ring;
+	u64			head;
+
+	u32			late_pkts_threshold;
+	u32			early_pkts_threshold;
+
+	/* Stalled TX streams, per interface */
+	unsigned long		*tx_stalled[2];
+};
+
 struct ra_sd_priv {
 	struct device		*dev;
 	struct miscdevice	misc;
@@ -40,26 +57,60 @@ struct ra_sd_priv {
 	struct dentry		*debugfs;
 	u32			max_tracks;
 
+	/* Take over the streams found in the hardware instead of resetting */
+	bool			adopt;
+
 	struct {
-		wait_queue_head_t		wait;
-		struct mutex			mutex;
-		bool				ready;
-		struct ra_sd_rtcp_tx_data_fpga	data;
+		struct ra_sd_rtcp_scan		scan;
+		struct ra_sd_stats_rtcp_tx	*cache;
 	} rtcp_tx;
 
 	struct {
-		wait_queue_head_t	wait;
-		struct mutex		mutex;
-		bool			ready;
-		struct ra_sd_rtcp_rx_data_fpga	data;
+		struct ra_sd_rtcp_scan		scan;
+		struct ra_sd_stats_rtcp_rx	*cache;
 	} rtcp_rx;
 
+	struct delayed_work	rtcp_work;
+
+	/* Statistics area shared with userspace through mmap() */
+	struct ra_sd_stats_header	*stats;
+
+	struct ra_sd_events	events;
+
+	struct {
+		/* Protects the configuration and all windows */
+		struct mutex	mutex;
+		struct xarray	streams;
+		u32		num_buckets;
+		u32		bucket_ms;
+	} history;
+
 	struct ra_sd_rx rx;
 	struct ra_sd_tx tx;
 };
 
 #define to_ra_sd_priv(x) container_of(x, struct ra_sd_priv, misc)
 
+/* Per file descriptor state */
+struct ra_sd_file {
+	struct ra_sd_priv	*priv;
+
+	/* Protects the staging area */
+	struct mutex		mutex;
+	struct list_head	staged;
+	unsigned int		num_staged;
+
+	/* Position in the event ring, protected by priv->events.lock */
+	u64			event_tail;
+
+	/*
+	 * Handover token of the streams detached from this file, 0 until
+	 * one is needed. Protected by mutex.
+	 */
+	u64			detach_token;
+	bool			detach_on_close;
+};
+
 static inline void ra_sd_iow(struct ra_sd_priv *priv, off_t offset, u32 value)
 {
 	iowrite32(value, priv->regs + offset);
@@ -84,6 +135,74 @@ static inline void ra_sd_read_rtcp_tx(struct ra_sd_priv *priv,
 	__ioread32_copy(fpga, src, sizeof(*fpga) / sizeof(u32));
 }
 
+/*
+ * Sequence number protocol of the statistics area, see the UAPI header.
+ * Writers of the same record must be serialized by the caller.
+ */
+static inline void ra_sd_stats_write_begin(__u32 *seq)
+{
+	WRITE_ONCE(*seq, *seq + 1);
+	smp_wmb();
+}
+
+static inline void ra_sd_stats_write_end(__u32 *seq)
+{
+	smp_wmb();
+	WRITE_ONCE(*seq, *seq + 1);
+}
+
+int ra_sd_stats_probe(struct ra_sd_priv *priv);
+void ra_sd_stats_update_counters(struct ra_sd_priv *priv);
+int ra_sd_stats_mmap(struct ra_sd_priv *priv, struct vm_area_struct *vma);
+
+int ra_sd_events_probe(struct ra_sd_priv *priv);
+void ra_sd_events_open(struct ra_sd_priv *priv, struct ra_sd_file *f);
+void ra_sd_events_rx_check(struct ra_sd_priv *priv, u32 index, u64 now,
+			   const struct ra_sd_rtcp_rx_data *old,
+			   const struct ra_sd_rtcp_rx_data *new);
+void ra_sd_events_tx_check(struct ra_sd_priv *priv, u32 index, u64 now,
+			   const struct ra_sd_tx_stream_elem *e,
+			   const struct ra_sd_rtcp_tx_data *old,
+			   const struct ra_sd_rtcp_tx_data *new);
+void ra_sd_events_tx_forget(struct ra_sd_priv *priv, u32 index);
+ssize_t ra_sd_events_read(struct ra_sd_priv *priv, struct file *filp,
+			  char __user *buf, size_t count);
+__poll_t ra_sd_events_poll(struct ra_sd_priv *priv, struct file *filp,
+			   poll_table *wait);
+int ra_sd_set_event_config_ioctl(struct ra_sd_priv *priv, unsigned int size,
+				 void __user *buf);
+
+int ra_sd_history_probe(struct ra_sd_priv *priv);
+void ra_sd_history_update(struct ra_sd_priv *priv);
+void ra_sd_history_forget(struct ra_sd_priv *priv, u32 index);
+int ra_sd_read_rx_history_ioctl(struct ra_sd_priv *priv, unsigned int size,
+				void __user *buf);
+int ra_sd_set_history_config_ioctl(struct ra_sd_priv *priv, unsigned int size,
+				   void __user *buf);
+
 int ra_sd_debugfs_init(struct ra_sd_priv *priv);
+int ra_sd_batch_validate_op(struct ra_sd_priv *priv,
+			    const struct ra_sd_batch_op *op);
+int ra_sd_batch_ioctl(struct ra_sd_priv *priv, struct file *filp,
+		      unsigned int size, void __user *buf);
+int ra_sd_set_active_ioctl(struct ra_sd_priv *priv, struct file *filp,
+			   unsigned int size, void __user *buf);
+int ra_sd_set_routes_ioctl(struct ra_sd_priv *priv, struct file *filp,
+			   unsigned int size, void __user *buf);
+
+int ra_sd_stage_ioctl(struct ra_sd_file *f, unsigned int size,
+		      void __user *buf);
+int ra_sd_commit_ioctl(struct ra_sd_file *f, struct file *filp,
+		       unsigned int size, void __user *buf);
+int ra_sd_discard_ioctl(struct ra_sd_file *f, unsigned int size,
+			void __user *buf);
+void ra_sd_discard_staged(struct ra_sd_file *f);
+
+int ra_sd_handover_probe(struct ra_sd_priv *priv);
+int ra_sd_detach_streams_ioctl(struct ra_sd_file *f, struct file *filp,
+			       unsigned int size, void __user *buf);
+int ra_sd_adopt_streams_ioctl(struct ra_sd_file *f, struct file *filp,
+			      unsigned int size, void __user *buf);
+void ra_sd_release_streams(struct ra_sd_file *f, struct file *filp);
 
 #endif /* RA_SD_MAIN_H */
@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/bitmap.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "main.h"
+
+/*
+ * New versions of the streams touched by a routing change, indexed by
+ * stream index. Untouched streams are NULL.
+ */
+struct ra_sd_routes {
+	struct ra_sd_rx_stream	**rx;
+	struct ra_sd_tx_stream	**tx;
+	unsigned long		*rx_tracks;
+};
+
+static void ra_sd_routes_free(struct ra_sd_priv *priv, struct ra_sd_routes *r)
+{
+	int i;
+
+	if (r->rx)
+		for (i = 0; i < priv->rx.sttb.max_entries; i++)
+			kfree(r->rx[i]);
+
+	if (r->tx)
+		for (i = 0; i < priv->tx.sttb.max_entries; i++)
+			kfree(r->tx[i]);
+
+	kfree(r->rx);
+	kfree(r->tx);
+	bitmap_free(r->rx_tracks);
+}
+
+static int ra_sd_routes_add(struct ra_sd_priv *priv, struct file *filp,
+			    struct ra_sd_routes *r,
+			    const struct ra_sd_route *route)
+{
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+
+	if (route->track >= (__s16)priv->max_tracks)
+		return -EINVAL;
+
+	switch (route->direction) {
+	case RA_SD_DIRECTION_RX:
+		if (route->index >= priv->rx.sttb.max_entries)
+			return -ENOENT;
+
+		rxe = ra_sd_rx_stream_elem_find_by_index(&priv->rx,
+							 route->index);
+		if (!rxe)
+			return -ENOENT;
+
+		/* Streams can only be updated by their creators */
+		if (rxe->filp != filp)
+			return -EACCES;
+
+		if (route->channel >= rxe->stream.num_channels)
+			return -EINVAL;
+
+		if (!r->rx[route->index]) {
+			r->rx[route->index] = kmemdup(&rxe->stream,
+						      sizeof(rxe->stream),
+						      GFP_KERNEL);
+			if (!r->rx[route->index])
+				return -ENOMEM;
+		}
+
+		r->rx[route->index]->tracks[route->channel] = route->track;
+		return 0;
+
+	case RA_SD_DIRECTION_TX:
+		if (route->index >= priv->tx.sttb.max_entries)
+			return -ENOENT;
+
+		txe = ra_sd_tx_stream_elem_find_by_index(&priv->tx,
+							 route->index);
+		if (!txe)
+			return -ENOENT;
+
+		if (txe->filp != filp)
+			return -EACCES;
+
+		if (route->channel >= txe->stream.num_channels)
+			return -EINVAL;
+
+		if (!r->tx[route->index]) {
+			r->tx[route->index] = kmemdup(&txe->stream,
+						      sizeof(txe->stream),
+						      GFP_KERNEL);
+			if (!r->tx[route->index])
+				return -ENOMEM;
+		}
+
+		r->tx[route->index]->tracks[route->channel] = route->track;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/* Checks the new RX routing against the tracks used by all other streams */
+static int ra_sd_routes_check_rx(struct ra_sd_priv *priv,
+				 struct ra_sd_routes *r)
+{
+	struct ra_sd_rx *rx = &priv->rx;
+	struct ra_sd_rx_stream_elem *e;
+	int i, ret;
+
+	bitmap_copy(r->rx_tracks, rx->used_tracks, priv->max_tracks);
+
+	for (i = 0; i < rx->sttb.max_entries; i++) {
+		if (!r->rx[i])
+			continue;
+
+		e = ra_sd_rx_stream_elem_find_by_index(rx, i);
+		ra_sd_rx_tracks_mark_unused(r->rx_tracks, &e->stream);
+	}
+
+	for (i = 0; i < rx->sttb.max_entries; i++) {
+		if (!r->rx[i])
+			continue;
+
+		ret = ra_sd_rx_tracks_available(rx, r->rx_tracks, r->rx[i]);
+		if (ret < 0)
+			return ret;
+
+		ra_sd_rx_tracks_mark_used(r->rx_tracks, r->rx[i]);
+	}
+
+	return 0;
+}
+
+static void ra_sd_routes_apply(struct ra_sd_priv *priv,
+			       struct ra_sd_routes *r)
+{
+	struct ra_sd_rx_stream_elem *rxe;
+	struct ra_sd_tx_stream_elem *txe;
+	int i;
+
+	for (i = 0; i < priv->rx.sttb.max_entries; i++) {
+		if (!r->rx[i])
+			continue;
+
+		rxe = ra_sd_rx_stream_elem_find_by_index(&priv->rx, i);
+		ra_track_table_update(&priv->rx.trtb, rxe->trtb_index,
+				      rxe->stream.num_channels,
+				      rxe->stream.tracks, r->rx[i]->tracks);
+		memcpy(rxe->stream.tracks, r->rx[i]->tracks,
+		       sizeof(rxe->stream.tracks));
+	}
+
+	bitmap_copy(priv->rx.used_tracks, r->rx_tracks, priv->max_tracks);
+
+	for (i = 0; i < priv->tx.sttb.max_entries; i++) {
+		if (!r->tx[i])
+			continue;
+
+		txe = ra_sd_tx_stream_elem_find_by_index(&priv->tx, i);
+		ra_track_table_update(&priv->tx.trtb, txe->trtb_index,
+				      txe->stream.num_channels,
+				      txe->stream.tracks, r->tx[i]->tracks);
+		memcpy(txe->stream.tracks, r->tx[i]->tracks,
+		       sizeof(txe->stream.tracks));
+	}
+}
+
+/*
+ * Applies a list of channel to track routing changes across any number of
+ * streams. All changes are validated, and RX track conflicts are checked,
+ * before anything is written. Only the affected track table entries are
+ * written; the stream tables are left alone.
+ */
+int ra_sd_set_routes_ioctl(struct ra_sd_priv *priv, struct file *filp,
+			   unsigned int size, void __user *buf)
+{
+	struct ra_sd_set_routes_cmd cmd;
+	struct ra_sd_routes r = {};
+	struct ra_sd_route *routes;
+	int i, ret = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.num_routes > RA_SD_SET_ROUTES_MAX_ENTRIES)
+		return -EINVAL;
+
+	if (cmd.num_routes == 0)
+		return 0;
+
+	routes = vmemdup_user(u64_to_user_ptr(cmd.routes),
+			      array_size(cmd.num_routes, sizeof(*routes)));
+	if (IS_ERR(routes))
+		return PTR_ERR(routes);
+
+	r.rx = kcalloc(priv->rx.sttb.max_entries, sizeof(*r.rx), GFP_KERNEL);
+	r.tx = kcalloc(priv->tx.sttb.max_entries, sizeof(*r.tx), GFP_KERNEL);
+	r.rx_tracks = bitmap_zalloc(priv->max_tracks, GFP_KERNEL);
+	if (!r.rx || !r.tx || !r.rx_tracks) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	mutex_lock(&priv->rx.mutex);
+	mutex_lock(&priv->tx.mutex);
+
+	for (i = 0; i < cmd.num_routes; i++) {
+		ret = ra_sd_routes_add(priv, filp, &r, &routes[i]);
+		if (ret < 0)
+			goto out_unlock;
+	}
+
+	ret = ra_sd_routes_check_rx(priv, &r);
+	if (ret < 0)
+		goto out_unlock;
+
+	ra_sd_routes_apply(priv, &r);
+
+out_unlock:
+	mutex_unlock(&priv->tx.mutex);
+	mutex_unlock(&priv->rx.mutex);
+
+out_free:
+	ra_sd_routes_free(priv, &r);
+	kvfree(routes);
+
+	return ret;
+}
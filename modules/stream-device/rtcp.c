@@ -1,23 +1,17 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
 #include <linux/wait.h>
 
 #include "main.h"
 #include "rtcp.h"
 
-void ra_sd_rtcp_rx_irq(struct ra_sd_priv *priv)
-{
-	ra_sd_read_rtcp_rx(priv, &priv->rtcp_rx.data);
-	WRITE_ONCE(priv->rtcp_rx.ready, true);
-	wake_up(&priv->rtcp_rx.wait);
-}
-
-void ra_sd_rtcp_tx_irq(struct ra_sd_priv *priv)
-{
-	ra_sd_read_rtcp_tx(priv, &priv->rtcp_tx.data);
-	WRITE_ONCE(priv->rtcp_tx.ready, true);
-	wake_up(&priv->rtcp_tx.wait);
-}
+/* Time between two sweeps over the pages of all streams */
+#define RA_SD_RTCP_SCAN_INTERVAL	(HZ / 10)
 
 static void ra_sd_parse_rtcp_rx_data(struct ra_sd_rtcp_rx_data_fpga *from,
 				     struct ra_sd_rtcp_rx_data *to)
@@ -73,12 +67,226 @@ static void ra_sd_parse_rtcp_tx_data(struct ra_sd_rtcp_tx_data_fpga *from,
 	to->secondary.sent_rtp_bytes = from->sec_sent_rtp_bytes;
 }
 
+/*
+ * Selects the page of the first stream at or after @index, or ends the sweep
+ * if there is none. Called with scan->lock held.
+ */
+static void ra_sd_rtcp_scan_select(struct ra_sd_priv *priv,
+				   struct ra_sd_rtcp_scan *scan,
+				   unsigned long index)
+{
+	lockdep_assert_held(&scan->lock);
+
+	if (index >= scan->max_entries ||
+	    !xa_find(scan->streams, &index, scan->max_entries - 1,
+		     XA_PRESENT)) {
+		scan->scanning = false;
+		return;
+	}
+
+	scan->scanning = true;
+	scan->index = index;
+	scan->selected = jiffies;
+
+	ra_sd_iow(priv, scan->page_select, index);
+}
+
+static void ra_sd_rtcp_scan_start(struct ra_sd_priv *priv,
+				  struct ra_sd_rtcp_scan *scan)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&scan->lock, flags);
+
+	/* Start a new sweep, or restart one that waits for a lost interrupt */
+	if (!scan->scanning ||
+	    time_after(jiffies, scan->selected + RA_SD_RTCP_SCAN_INTERVAL))
+		ra_sd_rtcp_scan_select(priv, scan, 0);
+
+	spin_unlock_irqrestore(&scan->lock, flags);
+}
+
+static void ra_sd_rtcp_work(struct work_struct *work)
+{
+	struct ra_sd_priv *priv =
+		container_of(to_delayed_work(work), struct ra_sd_priv,
+			     rtcp_work);
+
+	ra_sd_rtcp_scan_start(priv, &priv->rtcp_rx.scan);
+	ra_sd_rtcp_scan_start(priv, &priv->rtcp_tx.scan);
+	ra_sd_stats_update_counters(priv);
+	ra_sd_history_update(priv);
+
+	schedule_delayed_work(&priv->rtcp_work, RA_SD_RTCP_SCAN_INTERVAL);
+}
+
+/* Starts a sweep right away instead of waiting for the next interval */
+static void ra_sd_rtcp_kick(struct ra_sd_priv *priv)
+{
+	mod_delayed_work(system_wq, &priv->rtcp_work, 0);
+}
+
+void ra_sd_rtcp_rx_irq(struct ra_sd_priv *priv)
+{
+	struct ra_sd_rtcp_scan *scan = &priv->rtcp_rx.scan;
+	struct ra_sd_rtcp_rx_data_fpga fpga;
+	struct ra_sd_stats_rtcp_rx *c;
+	struct ra_sd_rtcp_rx_data data;
+	u64 now;
+
+	spin_lock(&scan->lock);
+
+	ra_sd_read_rtcp_rx(priv, &fpga);
+
+	if (scan->scanning) {
+		/* The stream may have been deleted in the meantime */
+		if (xa_load(scan->streams, scan->index)) {
+			c = &priv->rtcp_rx.cache[scan->index];
+			now = ktime_get_ns();
+			ra_sd_parse_rtcp_rx_data(&fpga, &data);
+
+			if (c->timestamp_ns)
+				ra_sd_events_rx_check(priv, scan->index, now,
+						      &c->data, &data);
+
+			ra_sd_stats_write_begin(&c->seq);
+			c->data = data;
+			c->timestamp_ns = now;
+			ra_sd_stats_write_end(&c->seq);
+		}
+
+		ra_sd_rtcp_scan_select(priv, scan, scan->index + 1);
+	}
+
+	spin_unlock(&scan->lock);
+
+	wake_up(&scan->wait);
+}
+
+void ra_sd_rtcp_tx_irq(struct ra_sd_priv *priv)
+{
+	struct ra_sd_rtcp_scan *scan = &priv->rtcp_tx.scan;
+	struct ra_sd_rtcp_tx_data_fpga fpga;
+	struct ra_sd_stats_rtcp_tx *c;
+	struct ra_sd_tx_stream_elem *e;
+	struct ra_sd_rtcp_tx_data data;
+	u64 now;
+
+	spin_lock(&scan->lock);
+
+	ra_sd_read_rtcp_tx(priv, &fpga);
+
+	if (scan->scanning) {
+		/*
+		 * Streams are only freed after ra_sd_rtcp_tx_forget(), which
+		 * takes the scan lock, so e stays valid here.
+		 */
+		e = xa_load(scan->streams, scan->index);
+		if (e) {
+			c = &priv->rtcp_tx.cache[scan->index];
+			now = ktime_get_ns();
+			ra_sd_parse_rtcp_tx_data(&fpga, &data);
+
+			if (c->timestamp_ns)
+				ra_sd_events_tx_check(priv, scan->index, now, e,
+						      &c->data, &data);
+
+			ra_sd_stats_write_begin(&c->seq);
+			c->data = data;
+			c->timestamp_ns = now;
+			ra_sd_stats_write_end(&c->seq);
+		}
+
+		ra_sd_rtcp_scan_select(priv, scan, scan->index + 1);
+	}
+
+	spin_unlock(&scan->lock);
+
+	wake_up(&scan->wait);
+}
+
+/*
+ * Drops the cached data of a stream index, so a stream which is later added
+ * at the same index never reports the statistics of its predecessor. Must be
+ * called from process context, after the stream has been erased from its
+ * xarray.
+ */
+void ra_sd_rtcp_rx_forget(struct ra_sd_priv *priv, u32 index)
+{
+	struct ra_sd_stats_rtcp_rx *c = &priv->rtcp_rx.cache[index];
+	unsigned long flags;
+
+	ra_sd_history_forget(priv, index);
+
+	spin_lock_irqsave(&priv->rtcp_rx.scan.lock, flags);
+	ra_sd_stats_write_begin(&c->seq);
+	c->timestamp_ns = 0;
+	memset(&c->data, 0, sizeof(c->data));
+	ra_sd_stats_write_end(&c->seq);
+	spin_unlock_irqrestore(&priv->rtcp_rx.scan.lock, flags);
+}
+
+void ra_sd_rtcp_tx_forget(struct ra_sd_priv *priv, u32 index)
+{
+	struct ra_sd_stats_rtcp_tx *c = &priv->rtcp_tx.cache[index];
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->rtcp_tx.scan.lock, flags);
+	ra_sd_stats_write_begin(&c->seq);
+	c->timestamp_ns = 0;
+	memset(&c->data, 0, sizeof(c->data));
+	ra_sd_stats_write_end(&c->seq);
+	ra_sd_events_tx_forget(priv, index);
+	spin_unlock_irqrestore(&priv->rtcp_tx.scan.lock, flags);
+}
+
+/*
+ * Copies the cached data of a stream to @data. Returns the time the data was
+ * read, or 0 if there is none.
+ */
+u64 ra_sd_rtcp_rx_cached(struct ra_sd_priv *priv, u32 index,
+			 struct ra_sd_rtcp_rx_data *data)
+{
+	struct ra_sd_stats_rtcp_rx *c = &priv->rtcp_rx.cache[index];
+	unsigned long flags;
+	u64 timestamp;
+
+	spin_lock_irqsave(&priv->rtcp_rx.scan.lock, flags);
+
+	timestamp = c->timestamp_ns;
+	if (timestamp)
+		*data = c->data;
+
+	spin_unlock_irqrestore(&priv->rtcp_rx.scan.lock, flags);
+
+	return timestamp;
+}
+
+static u64 ra_sd_rtcp_tx_cached(struct ra_sd_priv *priv, u32 index,
+				struct ra_sd_rtcp_tx_data *data)
+{
+	struct ra_sd_stats_rtcp_tx *c = &priv->rtcp_tx.cache[index];
+	unsigned long flags;
+	u64 timestamp;
+
+	spin_lock_irqsave(&priv->rtcp_tx.scan.lock, flags);
+
+	timestamp = c->timestamp_ns;
+	if (timestamp)
+		*data = c->data;
+
+	spin_unlock_irqrestore(&priv->rtcp_tx.scan.lock, flags);
+
+	return timestamp;
+}
+
 int ra_sd_read_rtcp_rx_stat_ioctl(struct ra_sd_priv *priv,
 				  unsigned int size,
-				  void __user *buf)
+				  void __user *buf,
+				  bool nowait)
 {
 	struct ra_sd_read_rtcp_rx_stat_cmd cmd;
-	int ret;
+	long ret;
 
 	if (size != sizeof(cmd))
 		return -EINVAL;
@@ -86,44 +294,48 @@ int ra_sd_read_rtcp_rx_stat_ioctl(struct ra_sd_priv *priv,
 	if (copy_from_user(&cmd, buf, sizeof(cmd)))
 		return -EFAULT;
 
-	if (cmd.index > 127)
+	if (cmd.index >= priv->rx.sttb.max_entries)
 		return -EINVAL;
 
-	mutex_lock(&priv->rtcp_rx.mutex);
+	/* The scanner never reads the page of a free index */
+	if (!xa_load(&priv->rx.streams, cmd.index))
+		return -ENOENT;
 
-	WRITE_ONCE(priv->rtcp_rx.ready, false);
-	ra_sd_iow(priv, RA_SD_RX_PAGE_SELECT, cmd.index);
+	if (ra_sd_rtcp_rx_cached(priv, cmd.index, &cmd.data)) {
+		cmd.timeout_ms = 0;
+	} else {
+		/* No data yet, wait for the scanner to read the page */
+		ra_sd_rtcp_kick(priv);
 
-	ret = wait_event_interruptible_timeout(priv->rtcp_rx.wait,
-					       priv->rtcp_rx.ready,
-					       msecs_to_jiffies(cmd.timeout_ms));
-	if (ret == 0)
-		ret = -ETIMEDOUT;
+		if (nowait)
+			return -EAGAIN;
 
-	if (ret < 0)
-		goto out_unlock;
+		ret = wait_event_interruptible_timeout(priv->rtcp_rx.scan.wait,
+				ra_sd_rtcp_rx_cached(priv, cmd.index, &cmd.data),
+				msecs_to_jiffies(cmd.timeout_ms));
+		if (ret == 0)
+			return -ETIMEDOUT;
 
-	/* Report elapsed time back to userspace */
-	cmd.timeout_ms -= jiffies_to_msecs(ret);
-	ret = 0;
+		if (ret < 0)
+			return ret;
 
-	ra_sd_parse_rtcp_rx_data(&priv->rtcp_rx.data, &cmd.data);
+		/* Report elapsed time back to userspace */
+		cmd.timeout_ms -= min(cmd.timeout_ms, jiffies_to_msecs(ret));
+	}
 
 	if (copy_to_user(buf, &cmd, sizeof(cmd)))
-		ret = -EFAULT;
-
-out_unlock:
-	mutex_unlock(&priv->rtcp_rx.mutex);
+		return -EFAULT;
 
-	return ret;
+	return 0;
 }
 
 int ra_sd_read_rtcp_tx_stat_ioctl(struct ra_sd_priv *priv,
 				  unsigned int size,
-				  void __user *buf)
+				  void __user *buf,
+				  bool nowait)
 {
 	struct ra_sd_read_rtcp_tx_stat_cmd cmd;
-	int ret;
+	long ret;
 
 	if (size != sizeof(cmd))
 		return -EINVAL;
@@ -131,34 +343,300 @@ int ra_sd_read_rtcp_tx_stat_ioctl(struct ra_sd_priv *priv,
 	if (copy_from_user(&cmd, buf, sizeof(cmd)))
 		return -EFAULT;
 
-	if (cmd.index > 127)
+	if (cmd.index >= priv->tx.sttb.max_entries)
 		return -EINVAL;
 
-	mutex_lock(&priv->rtcp_tx.mutex);
+	if (!xa_load(&priv->tx.streams, cmd.index))
+		return -ENOENT;
 
-	WRITE_ONCE(priv->rtcp_tx.ready, false);
-	ra_sd_iow(priv, RA_SD_TX_PAGE_SELECT, cmd.index);
+	if (ra_sd_rtcp_tx_cached(priv, cmd.index, &cmd.data)) {
+		cmd.timeout_ms = 0;
+	} else {
+		ra_sd_rtcp_kick(priv);
 
-	ret = wait_event_interruptible_timeout(priv->rtcp_tx.wait,
-					       priv->rtcp_tx.ready,
-					       msecs_to_jiffies(cmd.timeout_ms));
-	if (ret == 0)
-		ret = -ETIMEDOUT;
+		if (nowait)
+			return -EAGAIN;
 
-	if (ret < 0)
-		goto out_unlock;
+		ret = wait_event_interruptible_timeout(priv->rtcp_tx.scan.wait,
+				ra_sd_rtcp_tx_cached(priv, cmd.index, &cmd.data),
+				msecs_to_jiffies(cmd.timeout_ms));
+		if (ret == 0)
+			return -ETIMEDOUT;
 
-	/* Report elapsed time back to userspace */
-	cmd.timeout_ms -= jiffies_to_msecs(ret);
-	ret = 0;
+		if (ret < 0)
+			return ret;
 
-	ra_sd_parse_rtcp_tx_data(&priv->rtcp_tx.data, &cmd.data);
+		cmd.timeout_ms -= min(cmd.timeout_ms, jiffies_to_msecs(ret));
+	}
 
 	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static void ra_sd_rtcp_rx_fill(struct ra_sd_priv *priv,
+				struct ra_sd_rtcp_rx_record *r, u64 now)
+{
+	u64 timestamp;
+
+	r->age_us = 0;
+	r->reserved_0 = 0;
+
+	if (!xa_load(&priv->rx.streams, r->index)) {
+		r->status = RA_SD_RTCP_STATUS_NO_STREAM;
+		memset(&r->data, 0, sizeof(r->data));
+		return;
+	}
+
+	timestamp = ra_sd_rtcp_rx_cached(priv, r->index, &r->data);
+	if (!timestamp) {
+		r->status = RA_SD_RTCP_STATUS_NO_DATA;
+		memset(&r->data, 0, sizeof(r->data));
+		return;
+	}
+
+	r->status = RA_SD_RTCP_STATUS_OK;
+	r->age_us = min_t(u64, div_u64(now - timestamp, NSEC_PER_USEC), U32_MAX);
+}
+
+int ra_sd_read_rtcp_rx_stats_ioctl(struct ra_sd_priv *priv,
+				   unsigned int size,
+				   void __user *buf)
+{
+	struct ra_sd_rtcp_rx_record *records;
+	struct ra_sd_read_rtcp_stats_cmd cmd;
+	struct ra_sd_rx_stream_elem *e;
+	bool missing = false;
+	unsigned long index;
+	u32 i, n = 0;
+	u64 now;
+	int ret = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.flags & ~RA_SD_RTCP_STATS_ALL)
+		return -EINVAL;
+
+	if (cmd.num_records > RA_SD_RTCP_STATS_MAX_RECORDS)
+		return -EINVAL;
+
+	if (cmd.flags & RA_SD_RTCP_STATS_ALL) {
+		records = kvcalloc(cmd.num_records, sizeof(*records),
+				   GFP_KERNEL);
+		if (!records)
+			return -ENOMEM;
+
+		cmd.num_streams = 0;
+
+		xa_for_each(&priv->rx.streams, index, e) {
+			if (n < cmd.num_records)
+				records[n++].index = index;
+
+			cmd.num_streams++;
+		}
+	} else {
+		records = vmemdup_user(u64_to_user_ptr(cmd.records),
+				       array_size(cmd.num_records,
+						  sizeof(*records)));
+		if (IS_ERR(records))
+			return PTR_ERR(records);
+
+		for (i = 0; i < cmd.num_records; i++) {
+			if (records[i].index >= priv->rx.sttb.max_entries) {
+				ret = -EINVAL;
+				goto out_free;
+			}
+		}
+
+		n = cmd.num_records;
+		cmd.num_streams = 0;
+	}
+
+	now = ktime_get_ns();
+
+	for (i = 0; i < n; i++) {
+		ra_sd_rtcp_rx_fill(priv, &records[i], now);
+
+		if (records[i].status == RA_SD_RTCP_STATUS_NO_DATA)
+			missing = true;
+	}
+
+	/* Don't wait for the data, but make sure it is read soon */
+	if (missing)
+		ra_sd_rtcp_kick(priv);
+
+	cmd.num_records = n;
+
+	if (copy_to_user(u64_to_user_ptr(cmd.records), records,
+			 array_size(n, sizeof(*records))) ||
+	    copy_to_user(buf, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+out_free:
+	kvfree(records);
+
+	return ret;
+}
+
+static void ra_sd_rtcp_tx_fill(struct ra_sd_priv *priv,
+				struct ra_sd_rtcp_tx_record *r, u64 now)
+{
+	u64 timestamp;
+
+	r->age_us = 0;
+	r->reserved_0 = 0;
+
+	if (!xa_load(&priv->tx.streams, r->index)) {
+		r->status = RA_SD_RTCP_STATUS_NO_STREAM;
+		memset(&r->data, 0, sizeof(r->data));
+		return;
+	}
+
+	timestamp = ra_sd_rtcp_tx_cached(priv, r->index, &r->data);
+	if (!timestamp) {
+		r->status = RA_SD_RTCP_STATUS_NO_DATA;
+		memset(&r->data, 0, sizeof(r->data));
+		return;
+	}
+
+	r->status = RA_SD_RTCP_STATUS_OK;
+	r->age_us = min_t(u64, div_u64(now - timestamp, NSEC_PER_USEC), U32_MAX);
+}
+
+int ra_sd_read_rtcp_tx_stats_ioctl(struct ra_sd_priv *priv,
+				   unsigned int size,
+				   void __user *buf)
+{
+	struct ra_sd_rtcp_tx_record *records;
+	struct ra_sd_read_rtcp_stats_cmd cmd;
+	struct ra_sd_tx_stream_elem *e;
+	bool missing = false;
+	unsigned long index;
+	u32 i, n = 0;
+	u64 now;
+	int ret = 0;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.flags & ~RA_SD_RTCP_STATS_ALL)
+		return -EINVAL;
+
+	if (cmd.num_records > RA_SD_RTCP_STATS_MAX_RECORDS)
+		return -EINVAL;
+
+	if (cmd.flags & RA_SD_RTCP_STATS_ALL) {
+		records = kvcalloc(cmd.num_records, sizeof(*records),
+				   GFP_KERNEL);
+		if (!records)
+			return -ENOMEM;
+
+		cmd.num_streams = 0;
+
+		xa_for_each(&priv->tx.streams, index, e) {
+			if (n < cmd.num_records)
+				records[n++].index = index;
+
+			cmd.num_streams++;
+		}
+	} else {
+		records = vmemdup_user(u64_to_user_ptr(cmd.records),
+				       array_size(cmd.num_records,
+						  sizeof(*records)));
+		if (IS_ERR(records))
+			return PTR_ERR(records);
+
+		for (i = 0; i < cmd.num_records; i++) {
+			if (records[i].index >= priv->tx.sttb.max_entries) {
+				ret = -EINVAL;
+				goto out_free;
+			}
+		}
+
+		n = cmd.num_records;
+		cmd.num_streams = 0;
+	}
+
+	now = ktime_get_ns();
+
+	for (i = 0; i < n; i++) {
+		ra_sd_rtcp_tx_fill(priv, &records[i], now);
+
+		if (records[i].status == RA_SD_RTCP_STATUS_NO_DATA)
+			missing = true;
+	}
+
+	/* Don't wait for the data, but make sure it is read soon */
+	if (missing)
+		ra_sd_rtcp_kick(priv);
+
+	cmd.num_records = n;
+
+	if (copy_to_user(u64_to_user_ptr(cmd.records), records,
+			 array_size(n, sizeof(*records))) ||
+	    copy_to_user(buf, &cmd, sizeof(cmd)))
 		ret = -EFAULT;
 
-out_unlock:
-	mutex_unlock(&priv->rtcp_tx.mutex);
+out_free:
+	kvfree(records);
 
 	return ret;
 }
+
+static void ra_sd_rtcp_scan_stop(struct ra_sd_rtcp_scan *scan)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&scan->lock, flags);
+	scan->scanning = false;
+	spin_unlock_irqrestore(&scan->lock, flags);
+}
+
+/*
+ * A sweep continues from the IRQ handler on its own, and the IRQ is only
+ * released after the cache and the event ring are freed.
+ */
+static void ra_sd_rtcp_stop(void *data)
+{
+	struct ra_sd_priv *priv = data;
+
+	cancel_delayed_work_sync(&priv->rtcp_work);
+
+	ra_sd_rtcp_scan_stop(&priv->rtcp_rx.scan);
+	ra_sd_rtcp_scan_stop(&priv->rtcp_tx.scan);
+
+	ra_sd_iow(priv, RA_SD_IRQ_MASK, RA_SD_IRQ_RTCP_RX | RA_SD_IRQ_RTCP_TX);
+}
+
+int ra_sd_rtcp_probe(struct ra_sd_priv *priv)
+{
+	struct ra_sd_rtcp_scan *rx = &priv->rtcp_rx.scan;
+	struct ra_sd_rtcp_scan *tx = &priv->rtcp_tx.scan;
+
+	rx->streams = &priv->rx.streams;
+	rx->max_entries = priv->rx.sttb.max_entries;
+	rx->page_select = RA_SD_RX_PAGE_SELECT;
+
+	tx->streams = &priv->tx.streams;
+	tx->max_entries = priv->tx.sttb.max_entries;
+	tx->page_select = RA_SD_TX_PAGE_SELECT;
+
+	INIT_DELAYED_WORK(&priv->rtcp_work, ra_sd_rtcp_work);
+	schedule_delayed_work(&priv->rtcp_work, RA_SD_RTCP_SCAN_INTERVAL);
+
+	return devm_add_action_or_reset(priv->dev, ra_sd_rtcp_stop, priv);
+}
@@ -4,6 +4,12 @@
 #define RA_SD_RTCP_H
 
 #include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+
+#include <uapi/ravenna/stream-device.h>
 
 struct ra_sd_rtcp_rx_data_fpga {
 #ifdef __LITTLE_ENDIAN
@@ -49,16 +55,49 @@ struct ra_sd_rtcp_tx_data_fpga {
 	u32 sec_sent_rtp_bytes;			/* DATA_4 */
 } __packed;
 
+/*
+ * State of the background RTCP page scanner of one direction. Pages of all
+ * streams in @streams are selected one after another; the interrupt handler
+ * stores the data in the cache and selects the next page right away.
+ */
+struct ra_sd_rtcp_scan {
+	/* Protects the scan state and the cache, taken from the IRQ handler */
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+
+	struct xarray		*streams;
+	u32			max_entries;
+	off_t			page_select;
+
+	bool			scanning;
+	unsigned long		index;
+	unsigned long		selected;
+};
+
 struct ra_sd_priv;
 
+int ra_sd_rtcp_probe(struct ra_sd_priv *priv);
+void ra_sd_rtcp_rx_forget(struct ra_sd_priv *priv, u32 index);
+void ra_sd_rtcp_tx_forget(struct ra_sd_priv *priv, u32 index);
+u64 ra_sd_rtcp_rx_cached(struct ra_sd_priv *priv, u32 index,
+			 struct ra_sd_rtcp_rx_data *data);
+
 void ra_sd_rtcp_rx_irq(struct ra_sd_priv *priv);
 void ra_sd_rtcp_tx_irq(struct ra_sd_priv *priv);
 
 int ra_sd_read_rtcp_rx_stat_ioctl(struct ra_sd_priv *priv,
 				  unsigned int size,
-				  void __user *buf);
+				  void __user *buf,
+				  bool nowait);
 int ra_sd_read_rtcp_tx_stat_ioctl(struct ra_sd_priv *priv,
 				  unsigned int size,
-				  void __user *buf);
+				  void __user *buf,
+				  bool nowait);
+int ra_sd_read_rtcp_rx_stats_ioctl(struct ra_sd_priv *priv,
+				   unsigned int size,
+				   void __user *buf);
+int ra_sd_read_rtcp_tx_stats_ioctl(struct ra_sd_priv *priv,
+				   unsigned int size,
+				   void __user *buf);
 
 #endif /* RA_SD_RTCP_H */
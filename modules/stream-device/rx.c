@@ -3,11 +3,12 @@
 #define DEBUG 1
 
 #include <linux/of.h>
+#include <linux/sort.h>
 
 #include "main.h"
 #include "rtp.h"
 
-static struct ra_sd_rx_stream_elem *
+struct ra_sd_rx_stream_elem *
 ra_sd_rx_stream_elem_find_by_index(struct ra_sd_rx *rx, int index)
 {
 	struct ra_sd_rx_stream_elem *e = xa_load(&rx->streams, index);
@@ -15,6 +16,73 @@ ra_sd_rx_stream_elem_find_by_index(struct ra_sd_rx *rx, int index)
 	return xa_is_err(e) ? NULL : e;
 }
 
+static const struct rhashtable_params ra_sd_rx_addr_params = {
+	.key_len		= sizeof(struct ra_sd_rx_addr_key),
+	.key_offset		= offsetof(struct ra_sd_rx_addr_node, key),
+	.head_offset		= offsetof(struct ra_sd_rx_addr_node, node),
+	.automatic_shrinking	= true,
+};
+
+/*
+ * Enters the destination addresses of a stream into rx->addrs. Must be called
+ * with rx->mutex held whenever a stream is added or its addresses may have
+ * changed, paired with ra_sd_rx_addrs_del().
+ */
+void ra_sd_rx_addrs_add(struct ra_sd_rx *rx, struct ra_sd_rx_stream_elem *e,
+			u32 index)
+{
+	const struct ra_sd_rx_stream_interface *iface;
+	struct ra_sd_rx_addr_node *n;
+	int i, ret;
+
+	lockdep_assert_held(&rx->mutex);
+
+	for (i = 0; i < ARRAY_SIZE(e->addrs); i++) {
+		iface = i == 0 ? &e->stream.primary : &e->stream.secondary;
+		n = &e->addrs[i];
+
+		if (iface->destination_ip == 0)
+			continue;
+
+		n->key.ip = iface->destination_ip;
+		n->key.port = iface->destination_port;
+		n->key.reserved = 0;
+		n->index = index;
+
+		/* ST 2022-7 often uses the same group on both networks */
+		if (i > 0 && e->addrs[0].linked &&
+		    !memcmp(&n->key, &e->addrs[0].key, sizeof(n->key)))
+			continue;
+
+		ret = rhltable_insert(&rx->addrs, &n->node,
+				      ra_sd_rx_addr_params);
+		if (ret < 0) {
+			/* Only lookups suffer from this */
+			dev_warn(rx->dev, "Cannot index RX stream %u: %d\n",
+				 index, ret);
+			continue;
+		}
+
+		n->linked = true;
+	}
+}
+
+void ra_sd_rx_addrs_del(struct ra_sd_rx *rx, struct ra_sd_rx_stream_elem *e)
+{
+	int i;
+
+	lockdep_assert_held(&rx->mutex);
+
+	for (i = 0; i < ARRAY_SIZE(e->addrs); i++) {
+		if (!e->addrs[i].linked)
+			continue;
+
+		rhltable_remove(&rx->addrs, &e->addrs[i].node,
+				ra_sd_rx_addr_params);
+		e->addrs[i].linked = false;
+	}
+}
+
 static int
 ra_sd_rx_validate_stream_interface(const struct ra_sd_rx_stream_interface *iface)
 {
@@ -25,8 +93,8 @@ ra_sd_rx_validate_stream_interface(const struct ra_sd_rx_stream_interface *iface
 	return 0;
 }
 
-static int ra_sd_rx_validate_stream(const struct ra_sd_rx *rx,
-				    const struct ra_sd_rx_stream *stream)
+int ra_sd_rx_validate_stream(const struct ra_sd_rx *rx,
+			     const struct ra_sd_rx_stream *stream)
 {
 	struct ra_sd_priv *priv = container_of(rx, struct ra_sd_priv, rx);
 	int i, ret;
@@ -65,78 +133,142 @@ static int ra_sd_rx_validate_stream(const struct ra_sd_rx *rx,
 	return 0;
 }
 
-static int ra_sd_rx_tracks_available(const struct ra_sd_rx *rx,
-				     const struct ra_sd_rx_stream *stream)
+/*
+ * Checks the tracks of a stream against @used, which is either
+ * rx->used_tracks or a snapshot of it. Must be called with rx->mutex held.
+ */
+int ra_sd_rx_tracks_available(const struct ra_sd_rx *rx,
+			      const unsigned long *used,
+			      const struct ra_sd_rx_stream *stream)
 {
 	struct ra_sd_priv *priv = container_of(rx, struct ra_sd_priv, rx);
-	unsigned long *used_tracks;
-	int i, ret = 0;
+	unsigned int n = 0;
+	int i;
+
+	lockdep_assert_held(&rx->mutex);
 
 	/*
-	 * To check if a track is assigned more than once, we need to allocate
-	 * a temporary bitmap because we can't modify rx->used_tracks until
-	 * we're sure the stream is valid.
+	 * Collect the tracks of the stream in a scratch bitmap, so the checks
+	 * below operate on whole words rather than on single channels.
 	 */
-	used_tracks = bitmap_zalloc(priv->max_tracks, GFP_KERNEL);
-	if (!used_tracks)
-		return -ENOMEM;
+	bitmap_zero(rx->stream_tracks, priv->max_tracks);
 
 	ra_for_each_active_track(i, stream->num_channels, stream->tracks) {
-		/* Track already used by the current operation? */
-		if (test_and_set_bit(stream->tracks[i], used_tracks))
-			ret = -EINVAL;
-
-		/* Track already used by another active stream? */
-		if (test_bit(stream->tracks[i], rx->used_tracks))
-			ret = -EBUSY;
-
-		if (ret < 0)
-			break;
+		__set_bit(stream->tracks[i], rx->stream_tracks);
+		n++;
 	}
 
-	bitmap_free(used_tracks);
+	/* Track assigned more than once by the stream itself? */
+	if (bitmap_weight(rx->stream_tracks, priv->max_tracks) != n)
+		return -EINVAL;
 
-	return ret;
+	/* Track already used by another active stream? */
+	if (bitmap_intersects(rx->stream_tracks, used, priv->max_tracks))
+		return -EBUSY;
+
+	return 0;
 }
 
-static void ra_sd_rx_tracks_mark_used(struct ra_sd_rx *rx,
-				      const struct ra_sd_rx_stream *stream)
+void ra_sd_rx_tracks_mark_used(unsigned long *used,
+			       const struct ra_sd_rx_stream *stream)
 {
 	int i;
 
 	ra_for_each_active_track(i, stream->num_channels, stream->tracks)
-		set_bit(stream->tracks[i], rx->used_tracks);
+		set_bit(stream->tracks[i], used);
 }
 
-static void ra_sd_rx_tracks_mark_unused(struct ra_sd_rx *rx,
-					const struct ra_sd_rx_stream *stream)
+void ra_sd_rx_tracks_mark_unused(unsigned long *used,
+				 const struct ra_sd_rx_stream *stream)
 {
 	int i;
 
 	ra_for_each_active_track(i, stream->num_channels, stream->tracks)
-		clear_bit(stream->tracks[i], rx->used_tracks);
+		clear_bit(stream->tracks[i], used);
 }
 
-int ra_sd_rx_add_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
-			      unsigned int size, void __user *buf)
+struct ra_sd_rx_defrag_entry {
+	struct ra_sd_rx_stream_elem	*e;
+	unsigned long			index;
+};
+
+static int ra_sd_rx_defrag_cmp(const void *a, const void *b)
 {
-	struct ra_sd_add_rx_stream_cmd cmd;
+	const struct ra_sd_rx_defrag_entry *ea = a, *eb = b;
+
+	return ea->e->trtb_index - eb->e->trtb_index;
+}
+
+/*
+ * Compacts the track table by moving streams, lowest track table index first,
+ * to the lowest free range that does not overlap with their current one. The
+ * new range is filled before the stream table entry is repointed, so streams
+ * keep playing. Returns the number of streams moved.
+ *
+ * Must be called with rx->mutex held.
+ */
+int ra_sd_rx_defrag(struct ra_sd_rx *rx)
+{
+	struct ra_sd_rx_defrag_entry *entries;
 	struct ra_sd_rx_stream_elem *e;
-	u32 index;
-	int ret;
+	unsigned long index, start;
+	int i, n = 0, moved = 0;
 
-	if (size != sizeof(cmd))
-		return -EINVAL;
+	lockdep_assert_held(&rx->mutex);
 
-	if (copy_from_user(&cmd, buf, sizeof(cmd)))
-		return -EFAULT;
+	entries = kcalloc(rx->sttb.max_entries, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
 
-	if (cmd.version != 0)
-		return -EINVAL;
+	xa_for_each(&rx->streams, index, e) {
+		entries[n].e = e;
+		entries[n].index = index;
+		n++;
+	}
 
-	ret = ra_sd_rx_validate_stream(rx, &cmd.stream);
-	if (ret < 0)
-		return ret;
+	sort(entries, n, sizeof(*entries), ra_sd_rx_defrag_cmp, NULL);
+
+	for (i = 0; i < n; i++) {
+		int num_channels;
+
+		e = entries[i].e;
+		num_channels = e->stream.num_channels;
+
+		start = bitmap_find_next_zero_area(rx->trtb.used_entries,
+						   rx->trtb.max_entries,
+						   0, num_channels, 0);
+		if (start + num_channels > e->trtb_index)
+			continue;
+
+		bitmap_set(rx->trtb.used_entries, start, num_channels);
+		ra_track_table_set(&rx->trtb, start, num_channels,
+				   e->stream.tracks);
+		ra_stream_table_rx_set_trtb_index(&rx->sttb, entries[i].index,
+						  start);
+		ra_track_table_free(&rx->trtb, e->trtb_index, num_channels);
+
+		dev_dbg(rx->dev, "Moved RX stream %lu from track table index %d to %lu\n",
+			entries[i].index, e->trtb_index, start);
+
+		e->trtb_index = start;
+		moved++;
+	}
+
+	kfree(entries);
+
+	return moved;
+}
+
+/* Must be called with rx->mutex held, and with a validated stream */
+static int ra_sd_rx_do_add_stream(struct ra_sd_rx *rx, struct file *filp,
+				  const struct ra_sd_rx_stream *stream)
+{
+	struct ra_sd_priv *priv = container_of(rx, struct ra_sd_priv, rx);
+	struct ra_sd_rx_stream_elem *e;
+	u32 index;
+	int ret;
+
+	lockdep_assert_held(&rx->mutex);
 
 	e = kzalloc(sizeof(*e), GFP_KERNEL);
 	if (!e)
@@ -144,53 +276,64 @@ int ra_sd_rx_add_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 
 	e->filp = filp;
 	e->pid = get_pid(task_pid(current));
-	memcpy(&e->stream, &cmd.stream, sizeof(e->stream));
+	memcpy(&e->stream, stream, sizeof(e->stream));
 
-	mutex_lock(&rx->mutex);
-
-	ret = ra_sd_rx_tracks_available(rx, &e->stream);
+	ret = ra_sd_rx_tracks_available(rx, rx->used_tracks, &e->stream);
 	if (ret < 0)
-		goto out_unlock;
+		goto out_free;
 
 	ret = xa_alloc(&rx->streams, &index, e,
 		       XA_LIMIT(0, rx->sttb.max_entries-1), GFP_KERNEL);
 	if (ret < 0) {
 		dev_err(rx->dev, "xa_alloc() failed: %d\n", ret);
-		goto out_unlock;
+		goto out_free;
 	}
 
 	ret = ra_track_table_alloc(&rx->trtb, e->stream.num_channels);
 	if (ret < 0) {
 		dev_err(rx->dev, "ra_track_table_alloc() failed: %d\n", ret);
 		xa_erase(&rx->streams, index);
-		goto out_unlock;
+		ra_sd_rtcp_rx_forget(priv, index);
+		goto out_free;
 	}
 
 	e->trtb_index = ret;
 
-	ra_sd_rx_tracks_mark_used(rx, &e->stream);
+	ra_sd_rx_tracks_mark_used(rx->used_tracks, &e->stream);
 	ra_track_table_set(&rx->trtb, e->trtb_index,
 			   e->stream.num_channels, e->stream.tracks);
 	ra_stream_table_rx_set(&rx->sttb, &e->stream, index, e->trtb_index);
+	ra_sd_rx_addrs_add(rx, e, index);
 
 	dev_dbg(rx->dev, "Added RX stream with index %d", index);
 
-out_unlock:
-	mutex_unlock(&rx->mutex);
+	return index;
 
-	if (ret < 0) {
-		kfree(e);
-		return ret;
-	}
+out_free:
+	put_pid(e->pid);
+	kfree(e);
 
-	return index;
+	return ret;
 }
 
-int ra_sd_rx_update_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
-				 unsigned int size, void __user *buf)
+int ra_sd_rx_add_stream(struct ra_sd_rx *rx, struct file *filp,
+			const struct ra_sd_rx_stream *stream)
 {
-	struct ra_sd_update_rx_stream_cmd cmd;
-	struct ra_sd_rx_stream_elem *e;
+	int ret;
+
+	ret = ra_sd_rx_do_add_stream(rx, filp, stream);
+
+	/* The track table may just be too fragmented */
+	if (ret == -ENOSPC && ra_sd_rx_defrag(rx) > 0)
+		ret = ra_sd_rx_do_add_stream(rx, filp, stream);
+
+	return ret;
+}
+
+int ra_sd_rx_add_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
+			      unsigned int size, void __user *buf)
+{
+	struct ra_sd_add_rx_stream_cmd cmd;
 	int ret;
 
 	if (size != sizeof(cmd))
@@ -207,32 +350,60 @@ int ra_sd_rx_update_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 		return ret;
 
 	mutex_lock(&rx->mutex);
+	ret = ra_sd_rx_add_stream(rx, filp, &cmd.stream);
+	mutex_unlock(&rx->mutex);
 
-	e = ra_sd_rx_stream_elem_find_by_index(rx, cmd.index);
-	if (!e) {
-		ret = -ENOENT;
-		goto out_unlock;
-	}
+	return ret;
+}
+
+/* Must be called with rx->mutex held, and with a validated stream */
+static int ra_sd_rx_do_update_stream(struct ra_sd_rx *rx, struct file *filp,
+				     u32 index,
+				     const struct ra_sd_rx_stream *stream)
+{
+	struct ra_sd_rx_stream_elem *e;
+	int ret;
+
+	lockdep_assert_held(&rx->mutex);
+
+	e = ra_sd_rx_stream_elem_find_by_index(rx, index);
+	if (!e)
+		return -ENOENT;
 
 	/* Streams can only be updated by their creators */
-	if (e->filp != filp) {
-		ret = -EACCES;
-		goto out_unlock;
-	}
+	if (e->filp != filp)
+		return -EACCES;
 
-	ra_sd_rx_tracks_mark_unused(rx, &e->stream);
+	ra_sd_rx_tracks_mark_unused(rx->used_tracks, &e->stream);
 
-	ret = ra_sd_rx_tracks_available(rx, &cmd.stream);
+	ret = ra_sd_rx_tracks_available(rx, rx->used_tracks, stream);
 	if (ret < 0)
 		goto out_rollback;
 
-	if (e->stream.num_channels != cmd.stream.num_channels) {
+	if (e->stream.num_channels != stream->num_channels) {
 		/*
-		* If the number of channels changes, we need to free the current
-		* track table allocation and reserve a new range of tracks.
+		* If the number of channels changes, try to shrink or grow the
+		* current track table allocation in place. Otherwise, we need to
+		* free it and reserve a new range of tracks.
 		*/
-		ra_track_table_free(&rx->trtb, e->trtb_index, e->stream.num_channels);
-		ret = ra_track_table_alloc(&rx->trtb, cmd.stream.num_channels);
+		if (stream->num_channels < e->stream.num_channels) {
+			ra_track_table_free(&rx->trtb,
+					    e->trtb_index + stream->num_channels,
+					    e->stream.num_channels -
+					    stream->num_channels);
+			ret = e->trtb_index;
+		} else if (ra_track_table_grow(&rx->trtb, rx->trtb.used_entries,
+					       e->trtb_index,
+					       e->stream.num_channels,
+					       stream->num_channels) == 0) {
+			ret = e->trtb_index;
+		} else {
+			ra_track_table_free(&rx->trtb, e->trtb_index,
+					    e->stream.num_channels);
+			ret = ra_track_table_alloc(&rx->trtb,
+						   stream->num_channels);
+		}
+
 		if (ret < 0) {
 			int aret = ret;
 
@@ -252,27 +423,72 @@ int ra_sd_rx_update_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 					   e->stream.num_channels,
 					   e->stream.tracks);
 			ra_stream_table_rx_set(&rx->sttb, &e->stream,
-					       cmd.index, e->trtb_index);
+					       index, e->trtb_index);
 
 			ret = aret;
 			goto out_rollback;
 		}
 
 		e->trtb_index = ret;
+		ra_track_table_set(&rx->trtb, e->trtb_index,
+				   stream->num_channels, stream->tracks);
+	} else {
+		/* Only touch the entries whose mapping changed */
+		ra_track_table_update(&rx->trtb, e->trtb_index,
+				      stream->num_channels,
+				      e->stream.tracks, stream->tracks);
 	}
 
-	memcpy(&e->stream, &cmd.stream, sizeof(e->stream));
+	ra_sd_rx_addrs_del(rx, e);
+	memcpy(&e->stream, stream, sizeof(e->stream));
+	ra_sd_rx_addrs_add(rx, e, index);
 
-	ra_sd_rx_tracks_mark_used(rx, &e->stream);
-	ra_track_table_set(&rx->trtb, e->trtb_index,
-			   e->stream.num_channels, e->stream.tracks);
-	ra_stream_table_rx_set(&rx->sttb, &e->stream, cmd.index, e->trtb_index);
+	ra_sd_rx_tracks_mark_used(rx->used_tracks, &e->stream);
+	ra_stream_table_rx_set(&rx->sttb, &e->stream, index, e->trtb_index);
+
+	return 0;
 
 out_rollback:
+	ra_sd_rx_tracks_mark_used(rx->used_tracks, &e->stream);
+
+	return ret;
+}
+
+int ra_sd_rx_update_stream(struct ra_sd_rx *rx, struct file *filp,
+			   u32 index, const struct ra_sd_rx_stream *stream)
+{
+	int ret;
+
+	ret = ra_sd_rx_do_update_stream(rx, filp, index, stream);
+
+	/* The track table may just be too fragmented */
+	if (ret == -ENOSPC && ra_sd_rx_defrag(rx) > 0)
+		ret = ra_sd_rx_do_update_stream(rx, filp, index, stream);
+
+	return ret;
+}
+
+int ra_sd_rx_update_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
+				 unsigned int size, void __user *buf)
+{
+	struct ra_sd_update_rx_stream_cmd cmd;
+	int ret;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	ret = ra_sd_rx_validate_stream(rx, &cmd.stream);
 	if (ret < 0)
-		ra_sd_rx_tracks_mark_used(rx, &e->stream);
+		return ret;
 
-out_unlock:
+	mutex_lock(&rx->mutex);
+	ret = ra_sd_rx_update_stream(rx, filp, cmd.index, &cmd.stream);
 	mutex_unlock(&rx->mutex);
 
 	return ret;
@@ -282,21 +498,73 @@ static void ra_sd_rx_free_stream(struct ra_sd_rx *rx,
 				 struct ra_sd_rx_stream_elem *e,
 				 int index)
 {
+	struct ra_sd_priv *priv = container_of(rx, struct ra_sd_priv, rx);
+
 	dev_dbg(rx->dev, "Deleting RX stream %d\n", index);
 
 	ra_track_table_free(&rx->trtb, e->trtb_index, e->stream.num_channels);
-	ra_sd_rx_tracks_mark_unused(rx, &e->stream);
+	ra_sd_rx_tracks_mark_unused(rx->used_tracks, &e->stream);
 	ra_stream_table_rx_del(&rx->sttb, index);
+	ra_sd_rx_addrs_del(rx, e);
 	xa_erase(&rx->streams, index);
+	ra_sd_rtcp_rx_forget(priv, index);
 	put_pid(e->pid);
 	kfree(e);
 }
 
+/* Must be called with rx->mutex held */
+int ra_sd_rx_delete_stream(struct ra_sd_rx *rx, struct file *filp, u32 index)
+{
+	struct ra_sd_rx_stream_elem *e;
+
+	lockdep_assert_held(&rx->mutex);
+
+	e = ra_sd_rx_stream_elem_find_by_index(rx, index);
+	if (!e) {
+		dev_dbg(rx->dev, "Failed to find RX stream with index %d\n",
+			index);
+		return -ENOENT;
+	}
+
+	/* Streams can only be torn down by their creators */
+	if (e->filp != filp)
+		return -EACCES;
+
+	ra_sd_rx_free_stream(rx, e, index);
+
+	return 0;
+}
+
 int ra_sd_rx_delete_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 				 unsigned int size, void __user *buf)
 {
 	struct ra_sd_delete_rx_stream_cmd cmd;
+	int ret;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	mutex_lock(&rx->mutex);
+	ret = ra_sd_rx_delete_stream(rx, filp, cmd.index);
+	mutex_unlock(&rx->mutex);
+
+	return ret;
+}
+
+int ra_sd_rx_list_streams_ioctl(struct ra_sd_rx *rx, unsigned int size,
+				void __user *buf)
+{
+	struct ra_sd_rx_stream_record *records, *r;
+	struct ra_sd_list_streams_cmd cmd;
 	struct ra_sd_rx_stream_elem *e;
+	unsigned long index;
+	u32 n = 0;
 	int ret = 0;
 
 	if (size != sizeof(cmd))
@@ -308,30 +576,96 @@ int ra_sd_rx_delete_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 	if (cmd.version != 0)
 		return -EINVAL;
 
+	if (cmd.num_records > RA_SD_LIST_MAX_RECORDS)
+		return -EINVAL;
+
+	records = kvcalloc(cmd.num_records, sizeof(*records), GFP_KERNEL);
+	if (!records)
+		return -ENOMEM;
+
+	cmd.num_streams = 0;
+
 	mutex_lock(&rx->mutex);
 
-	e = ra_sd_rx_stream_elem_find_by_index(rx, cmd.index);
-	if (!e) {
-		dev_dbg(rx->dev, "Failed to find RX stream with index %d\n",
-			cmd.index);
-		ret = -ENOENT;
-		goto out_unlock;
+	xa_for_each(&rx->streams, index, e) {
+		cmd.num_streams++;
+
+		if (n == cmd.num_records)
+			continue;
+
+		r = &records[n++];
+		r->index = index;
+		r->owner_pid = pid_vnr(e->pid);
+		r->primary = e->stream.primary;
+		r->secondary = e->stream.secondary;
+		r->num_channels = e->stream.num_channels;
+		r->codec = e->stream.codec;
+		r->active = e->stream.active;
+		r->trtb_index = e->trtb_index;
 	}
 
-	/* Streams can only be torn down by their creators */
-	if (e->filp != filp) {
-		ret = -EACCES;
-		goto out_unlock;
-	}
+	mutex_unlock(&rx->mutex);
 
-	ra_sd_rx_free_stream(rx, e, cmd.index);
+	cmd.num_records = n;
 
-out_unlock:
-	mutex_unlock(&rx->mutex);
+	if (copy_to_user(u64_to_user_ptr(cmd.records), records,
+			 array_size(n, sizeof(*records))) ||
+	    copy_to_user(buf, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+	kvfree(records);
 
 	return ret;
 }
 
+int ra_sd_rx_find_stream_ioctl(struct ra_sd_rx *rx, unsigned int size,
+			       void __user *buf)
+{
+	struct ra_sd_find_rx_stream_cmd cmd;
+	struct ra_sd_rx_addr_key key = {};
+	struct ra_sd_rx_addr_node *n;
+	struct rhlist_head *list, *pos;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	if (cmd.destination_ip == 0)
+		return -EINVAL;
+
+	key.ip = cmd.destination_ip;
+	key.port = cmd.destination_port;
+
+	cmd.index = U32_MAX;
+	cmd.num_matches = 0;
+
+	/* The nodes are freed along with their streams, without RCU */
+	mutex_lock(&rx->mutex);
+	rcu_read_lock();
+
+	list = rhltable_lookup(&rx->addrs, &key, ra_sd_rx_addr_params);
+	rhl_for_each_entry_rcu(n, pos, list, node) {
+		cmd.index = min(cmd.index, n->index);
+		cmd.num_matches++;
+	}
+
+	rcu_read_unlock();
+	mutex_unlock(&rx->mutex);
+
+	if (cmd.num_matches == 0)
+		return -ENOENT;
+
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
 int ra_sd_rx_delete_streams(struct ra_sd_rx *rx, struct file *filp)
 {
 	unsigned long index;
@@ -349,13 +683,171 @@ int ra_sd_rx_delete_streams(struct ra_sd_rx *rx, struct file *filp)
 	return 0;
 }
 
+/*
+ * Hands all streams owned by @from and @from_token over to @to and @to_token.
+ * A NULL file denotes detached streams, which are only kept alive by their
+ * token. Returns the number of streams transferred.
+ */
+int ra_sd_rx_transfer_streams(struct ra_sd_rx *rx, struct file *from,
+			     u64 from_token, struct file *to, u64 to_token)
+{
+	struct ra_sd_rx_stream_elem *e;
+	unsigned long index;
+	int n = 0;
+
+	mutex_lock(&rx->mutex);
+
+	xa_for_each(&rx->streams, index, e) {
+		if (e->filp != from || e->token != from_token)
+			continue;
+
+		put_pid(e->pid);
+		e->pid = to ? get_pid(task_pid(current)) : NULL;
+		e->filp = to;
+		e->token = to_token;
+		n++;
+	}
+
+	mutex_unlock(&rx->mutex);
+
+	return n;
+}
+
+/*
+ * Registers the entry at @index, as found in the hardware at probe time, as
+ * a detached stream. Returns -ENOENT if the entry is not valid.
+ */
+static int ra_sd_rx_adopt_stream(struct ra_sd_rx *rx, u32 index)
+{
+	struct ra_sd_rx_stream_elem *e;
+	int trtb_index, n, ret;
+
+	lockdep_assert_held(&rx->mutex);
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+
+	ret = ra_stream_table_rx_get(&rx->sttb, &e->stream, index, &trtb_index);
+	if (ret < 0)
+		goto out_free;
+
+	n = e->stream.num_channels;
+
+	if (n > RA_MAX_CHANNELS ||
+	    trtb_index + n > rx->trtb.max_entries ||
+	    find_next_bit(rx->trtb.used_entries, trtb_index + n,
+			  trtb_index) < trtb_index + n) {
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	ra_track_table_get(&rx->trtb, trtb_index, n, e->stream.tracks);
+
+	ret = ra_sd_rx_validate_stream(rx, &e->stream);
+	if (ret < 0)
+		goto out_free;
+
+	ret = ra_sd_rx_tracks_available(rx, rx->used_tracks, &e->stream);
+	if (ret < 0)
+		goto out_free;
+
+	ret = xa_insert(&rx->streams, index, e, GFP_KERNEL);
+	if (ret < 0)
+		goto out_free;
+
+	e->trtb_index = trtb_index;
+	e->token = RA_SD_TOKEN_ADOPTED;
+
+	bitmap_set(rx->trtb.used_entries, trtb_index, n);
+	ra_sd_rx_tracks_mark_used(rx->used_tracks, &e->stream);
+	ra_sd_rx_addrs_add(rx, e, index);
+
+	return 0;
+
+out_free:
+	kfree(e);
+
+	return ret;
+}
+
+/*
+ * Takes over the streams which were left running in the hardware, as
+ * detached streams with the token RA_SD_TOKEN_ADOPTED. Entries which are not
+ * consistent are deleted.
+ */
+int ra_sd_rx_adopt_streams(struct ra_sd_rx *rx)
+{
+	int i, n = 0, ret = 0;
+
+	mutex_lock(&rx->mutex);
+
+	for (i = 0; i < rx->sttb.max_entries; i++) {
+		ret = ra_sd_rx_adopt_stream(rx, i);
+		if (ret == -ENOENT)
+			continue;
+
+		if (ret == -ENOMEM)
+			break;
+
+		if (ret < 0) {
+			dev_warn(rx->dev, "Not adopting RX stream %d: %d\n",
+				 i, ret);
+			ra_stream_table_rx_del(&rx->sttb, i);
+			continue;
+		}
+
+		n++;
+	}
+
+	mutex_unlock(&rx->mutex);
+
+	if (ret == -ENOMEM)
+		return ret;
+
+	dev_info(rx->dev, "Adopted %d RX streams\n", n);
+
+	return 0;
+}
+
+/*
+ * Frees all detached streams, but leaves them running in the hardware for
+ * the next instance of the driver to adopt.
+ */
+void ra_sd_rx_abandon_streams(struct ra_sd_rx *rx)
+{
+	struct ra_sd_priv *priv = container_of(rx, struct ra_sd_priv, rx);
+	struct ra_sd_rx_stream_elem *e;
+	unsigned long index;
+
+	mutex_lock(&rx->mutex);
+
+	xa_for_each(&rx->streams, index, e) {
+		if (e->filp)
+			continue;
+
+		ra_sd_rx_addrs_del(rx, e);
+		xa_erase(&rx->streams, index);
+		ra_sd_rtcp_rx_forget(priv, index);
+		put_pid(e->pid);
+		kfree(e);
+	}
+
+	mutex_unlock(&rx->mutex);
+}
+
 static void ra_sd_rx_destroy_streams(void *xa)
 {
 	BUG_ON(!xa_empty(xa));
 	xa_destroy(xa);
 }
 
-int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev)
+static void ra_sd_rx_destroy_addrs(void *addrs)
+{
+	rhltable_destroy(addrs);
+}
+
+int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev, bool adopt)
 {
 	struct ra_sd_priv *priv = container_of(rx, struct ra_sd_priv, rx);
 	struct device_node *child_node;
@@ -370,7 +862,7 @@ int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev)
 		return -ENODEV;
 	}
 
-	ret = ra_stream_table_rx_probe(dev, child_node, &rx->sttb);
+	ret = ra_stream_table_rx_probe(dev, child_node, &rx->sttb, adopt);
 	of_node_put(child_node);
 	if (ret < 0)
 		return ret;
@@ -381,7 +873,7 @@ int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev)
 		return -ENODEV;
 	}
 
-	ret = ra_track_table_probe(dev, child_node, &rx->trtb);
+	ret = ra_track_table_probe(dev, child_node, &rx->trtb, adopt);
 	of_node_put(child_node);
 	if (ret < 0)
 		return ret;
@@ -394,9 +886,22 @@ int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev)
 	if (ret < 0)
 		return ret;
 
+	ret = rhltable_init(&rx->addrs, &ra_sd_rx_addr_params);
+	if (ret < 0)
+		return ret;
+
+	ret = devm_add_action_or_reset(dev, ra_sd_rx_destroy_addrs, &rx->addrs);
+	if (ret < 0)
+		return ret;
+
 	rx->used_tracks = devm_bitmap_zalloc(dev, priv->max_tracks, GFP_KERNEL);
 	if (!rx->used_tracks)
 		return -ENOMEM;
 
+	rx->stream_tracks = devm_bitmap_zalloc(dev, priv->max_tracks,
+					       GFP_KERNEL);
+	if (!rx->stream_tracks)
+		return -ENOMEM;
+
 	return 0;
 }
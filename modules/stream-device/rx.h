@@ -3,6 +3,8 @@
 #ifndef RA_SD_RX_H
 #define RA_SD_RX_H
 
+#include <linux/rhashtable.h>
+
 #include "stream-table-rx.h"
 #include "track-table.h"
 
@@ -13,6 +15,26 @@ struct ra_sd_rx {
 	struct mutex			mutex;
 	struct xarray			streams;
 	unsigned long			*used_tracks;
+
+	/* Scratch bitmap for track checks, protected by mutex */
+	unsigned long			*stream_tracks;
+
+	/* Streams by destination address, protected by mutex */
+	struct rhltable			addrs;
+};
+
+struct ra_sd_rx_addr_key {
+	__be32	ip;
+	__be16	port;
+	u16	reserved;
+};
+
+/* Entry in rx->addrs, one per interface of a stream */
+struct ra_sd_rx_addr_node {
+	struct rhlist_head		node;
+	struct ra_sd_rx_addr_key	key;
+	u32				index;
+	bool				linked;
 };
 
 struct ra_sd_rx_stream_elem {
@@ -20,15 +42,49 @@ struct ra_sd_rx_stream_elem {
 	struct file		*filp;
 	struct pid		*pid;
 	int			trtb_index;
+
+	/* Handover token while detached, i.e. while filp is NULL */
+	u64			token;
+
+	struct ra_sd_rx_addr_node	addrs[2];
 };
 
+struct ra_sd_rx_stream_elem *
+ra_sd_rx_stream_elem_find_by_index(struct ra_sd_rx *rx, int index);
+void ra_sd_rx_addrs_add(struct ra_sd_rx *rx, struct ra_sd_rx_stream_elem *e,
+			u32 index);
+void ra_sd_rx_addrs_del(struct ra_sd_rx *rx, struct ra_sd_rx_stream_elem *e);
+int ra_sd_rx_validate_stream(const struct ra_sd_rx *rx,
+			     const struct ra_sd_rx_stream *stream);
+int ra_sd_rx_tracks_available(const struct ra_sd_rx *rx,
+			      const unsigned long *used,
+			      const struct ra_sd_rx_stream *stream);
+void ra_sd_rx_tracks_mark_used(unsigned long *used,
+			       const struct ra_sd_rx_stream *stream);
+void ra_sd_rx_tracks_mark_unused(unsigned long *used,
+				 const struct ra_sd_rx_stream *stream);
+int ra_sd_rx_add_stream(struct ra_sd_rx *rx, struct file *filp,
+			const struct ra_sd_rx_stream *stream);
+int ra_sd_rx_update_stream(struct ra_sd_rx *rx, struct file *filp,
+			   u32 index, const struct ra_sd_rx_stream *stream);
+int ra_sd_rx_delete_stream(struct ra_sd_rx *rx, struct file *filp, u32 index);
+
 int ra_sd_rx_add_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 			      unsigned int size, void __user *buf);
 int ra_sd_rx_update_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 				 unsigned int size, void __user *buf);
 int ra_sd_rx_delete_stream_ioctl(struct ra_sd_rx *rx, struct file *filp,
 				 unsigned int size, void __user *buf);
+int ra_sd_rx_list_streams_ioctl(struct ra_sd_rx *rx, unsigned int size,
+				void __user *buf);
+int ra_sd_rx_find_stream_ioctl(struct ra_sd_rx *rx, unsigned int size,
+			       void __user *buf);
+int ra_sd_rx_defrag(struct ra_sd_rx *rx);
 int ra_sd_rx_delete_streams(struct ra_sd_rx *rx, struct file *filp);
-int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev);
+int ra_sd_rx_transfer_streams(struct ra_sd_rx *rx, struct file *from,
+			     u64 from_token, struct file *to, u64 to_token);
+int ra_sd_rx_adopt_streams(struct ra_sd_rx *rx);
+void ra_sd_rx_abandon_streams(struct ra_sd_rx *rx);
+int ra_sd_rx_probe(struct ra_sd_rx *rx, struct device *dev, bool adopt);
 
 #endif /* RA_SD_RX_H */
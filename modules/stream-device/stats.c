@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <linux/mm.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+
+#include "main.h"
+
+static void ra_sd_stats_free(void *area)
+{
+	vfree(area);
+}
+
+/*
+ * Allocates the statistics area. The RTCP records double as the RTCP cache,
+ * so the area must exist before the RTCP scanner is started.
+ */
+int ra_sd_stats_probe(struct ra_sd_priv *priv)
+{
+	struct ra_sd_stats_header *hdr;
+	u32 rx_offset, tx_offset;
+	size_t size;
+	void *area;
+	int ret;
+
+	rx_offset = ALIGN(sizeof(*hdr), SMP_CACHE_BYTES);
+	tx_offset = ALIGN(rx_offset + priv->rx.sttb.max_entries *
+			  sizeof(struct ra_sd_stats_rtcp_rx), SMP_CACHE_BYTES);
+	size = PAGE_ALIGN(tx_offset + priv->tx.sttb.max_entries *
+			  sizeof(struct ra_sd_stats_rtcp_tx));
+
+	area = vmalloc_user(size);
+	if (!area)
+		return -ENOMEM;
+
+	ret = devm_add_action_or_reset(priv->dev, ra_sd_stats_free, area);
+	if (ret < 0)
+		return ret;
+
+	hdr = area;
+	hdr->version = RA_SD_STATS_VERSION;
+	hdr->size = size;
+	hdr->num_rx_records = priv->rx.sttb.max_entries;
+	hdr->rx_record_size = sizeof(struct ra_sd_stats_rtcp_rx);
+	hdr->rx_offset = rx_offset;
+	hdr->num_tx_records = priv->tx.sttb.max_entries;
+	hdr->tx_record_size = sizeof(struct ra_sd_stats_rtcp_tx);
+	hdr->tx_offset = tx_offset;
+
+	priv->stats = hdr;
+	priv->rtcp_rx.cache = area + rx_offset;
+	priv->rtcp_tx.cache = area + tx_offset;
+
+	return 0;
+}
+
+/* Called periodically from the RTCP work, which serializes the writers */
+void ra_sd_stats_update_counters(struct ra_sd_priv *priv)
+{
+	struct ra_sd_stats_header *hdr = priv->stats;
+
+	ra_sd_stats_write_begin(&hdr->seq);
+	hdr->rx_dec_drop = ra_sd_ior(priv, RA_SD_CNT_RX_DEC_DROP);
+	hdr->rx_dec_fifo_ovr = ra_sd_ior(priv, RA_SD_CNT_RX_DEC_FIFO_OVR);
+	hdr->counters_timestamp_ns = ktime_get_ns();
+	ra_sd_stats_write_end(&hdr->seq);
+}
+
+int ra_sd_stats_mmap(struct ra_sd_priv *priv, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start > priv->stats->size)
+		return -EINVAL;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, priv->stats, 0);
+}
@@ -18,6 +18,10 @@
 
 /* rtp_filter_vlan_id */
 #define RA_STREAM_TABLE_RX_RTP_FILTER		BIT(15)
+#define RA_STREAM_TABLE_RX_VLAN_ID		GENMASK(11, 0)
+
+/* Index of the 32-bit word that holds misc_control */
+#define RA_STREAM_TABLE_RX_CTRL_WORD		3
 
 struct ra_stream_table_rx_fpga {
 #ifdef __LITTLE_ENDIAN
@@ -58,18 +62,55 @@ void ra_stream_table_rx_stream_write(struct ra_stream_table_rx *sttb,
 	BUG_ON(index >= sttb->max_entries);
 
 	__iowrite32_copy(dest, fpga, sizeof(*fpga) / sizeof(u32));
+	memcpy(&sttb->shadow[index], fpga, sizeof(*fpga));
+	cpu_relax();
+}
+
+static inline
+void ra_stream_table_rx_word_write(struct ra_stream_table_rx *sttb,
+				   int index, int word, u32 val)
+{
+	void __iomem *dest = sttb->regs +
+		sizeof(struct ra_stream_table_rx_fpga) * index +
+		sizeof(u32) * word;
+	u32 *shadow = (u32 *)&sttb->shadow[index];
+
+	iowrite32(val, dest);
+	shadow[word] = val;
+}
+
+/*
+ * Only writes the words that differ from the shadow copy. The control word
+ * is always written, and always last, as it carries the VLD and EXEC_HASH
+ * bits.
+ */
+static void ra_stream_table_rx_stream_update(struct ra_stream_table_rx *sttb,
+					     struct ra_stream_table_rx_fpga *fpga,
+					     int index)
+{
+	const u32 *old = (const u32 *)&sttb->shadow[index];
+	const u32 *new = (const u32 *)fpga;
+	int i;
+
+	BUG_ON(index >= sttb->max_entries);
+
+	for (i = 0; i < sizeof(*fpga) / sizeof(u32); i++)
+		if (i != RA_STREAM_TABLE_RX_CTRL_WORD && new[i] != old[i])
+			ra_stream_table_rx_word_write(sttb, index, i, new[i]);
+
+	ra_stream_table_rx_word_write(sttb, index, RA_STREAM_TABLE_RX_CTRL_WORD,
+				      new[RA_STREAM_TABLE_RX_CTRL_WORD]);
 	cpu_relax();
 }
 
+/* Entries are read from the shadow copy, the hardware is only read at probe */
 static inline
 void ra_stream_table_rx_stream_read(struct ra_stream_table_rx *sttb,
 				    struct ra_stream_table_rx_fpga *fpga,
 				    int index)
 {
-	void __iomem *src = sttb->regs + sizeof(*fpga) * index;
-
 	BUG_ON(index >= sttb->max_entries);
-	__ioread32_copy(fpga, src, sizeof(*fpga) / sizeof(u32));
+	memcpy(fpga, &sttb->shadow[index], sizeof(*fpga));
 }
 
 static void ra_stream_table_rx_fill(const struct ra_sd_rx_stream *stream,
@@ -130,25 +171,58 @@ static void ra_stream_table_rx_fill(const struct ra_sd_rx_stream *stream,
 		fpga->misc_control |= RA_STREAM_TABLE_RX_MISC_SYNCHRONOUS;
 }
 
+/*
+ * A valid entry has to be invalidated and re-hashed if any of the fields
+ * that go into the hash (IPs, ports, VLAN) change, or if the layout of the
+ * stream in the track table changes. Everything else can be updated in place.
+ */
+static bool
+ra_stream_table_rx_key_changed(const struct ra_stream_table_rx_fpga *cur,
+			       const struct ra_stream_table_rx_fpga *new)
+{
+	return cur->destination_ip_primary != new->destination_ip_primary	||
+	       cur->destination_ip_secondary != new->destination_ip_secondary	||
+	       cur->destination_port_primary != new->destination_port_primary	||
+	       cur->destination_port_secondary != new->destination_port_secondary ||
+	       (cur->rtp_filter_vlan_id ^ new->rtp_filter_vlan_id) &
+			RA_STREAM_TABLE_RX_VLAN_ID				||
+	       (cur->misc_control ^ new->misc_control) &
+			RA_STREAM_TABLE_RX_MISC_VLAN				||
+	       cur->num_channels != new->num_channels				||
+	       cur->codec != new->codec						||
+	       cur->trtp_base_addr != new->trtp_base_addr;
+}
+
 void ra_stream_table_rx_set(struct ra_stream_table_rx *sttb,
 			    struct ra_sd_rx_stream *stream,
 			    int index, int trtb_index)
 {
-	struct ra_stream_table_rx_fpga fpga = { 0 };
-
-	/* Set the VLD bit to 0 before touching other fields */
-	ra_stream_table_rx_stream_write(sttb, &fpga, index);
+	const struct ra_stream_table_rx_fpga *cur = &sttb->shadow[index];
+	struct ra_stream_table_rx_fpga fpga;
+	bool valid, in_place;
 
 	/* Fill all the details, but don't touch the misc bits VLD and EXEC_HASH */
 	ra_stream_table_rx_fill(stream, &fpga, trtb_index);
-	ra_stream_table_rx_stream_write(sttb, &fpga, index);
 
-	/* Now activate the stream and trigger a hash operation */
-	fpga.misc_control |=
-		RA_STREAM_TABLE_RX_MISC_VLD |
-		RA_STREAM_TABLE_RX_MISC_EXEC_HASH;
+	valid = cur->misc_control & RA_STREAM_TABLE_RX_MISC_VLD;
+	in_place = valid && !ra_stream_table_rx_key_changed(cur, &fpga);
 
-	ra_stream_table_rx_stream_write(sttb, &fpga, index);
+	/* Set the VLD bit to 0 before touching other fields */
+	if (valid && !in_place)
+		ra_stream_table_rx_word_write(sttb, index,
+					      RA_STREAM_TABLE_RX_CTRL_WORD, 0);
+
+	/*
+	 * Write what changed, then activate the stream. A hash operation is
+	 * only triggered if the entry is new or its key changed, so in-place
+	 * updates don't interrupt the audio.
+	 */
+	fpga.misc_control |= RA_STREAM_TABLE_RX_MISC_VLD;
+
+	if (!in_place)
+		fpga.misc_control |= RA_STREAM_TABLE_RX_MISC_EXEC_HASH;
+
+	ra_stream_table_rx_stream_update(sttb, &fpga, index);
 }
 
 void ra_stream_table_rx_del(struct ra_stream_table_rx *sttb, int index)
@@ -161,7 +235,112 @@ void ra_stream_table_rx_del(struct ra_stream_table_rx *sttb, int index)
 	fpga.misc_control &= ~RA_STREAM_TABLE_RX_MISC_ACT;
 	fpga.misc_control |=  RA_STREAM_TABLE_RX_MISC_EXEC_HASH;
 
-	ra_stream_table_rx_stream_write(sttb, &fpga, index);
+	ra_stream_table_rx_stream_update(sttb, &fpga, index);
+}
+
+/* Toggles the ACT bit of a valid entry, without re-hashing it */
+void ra_stream_table_rx_set_active(struct ra_stream_table_rx *sttb,
+				   int index, bool active)
+{
+	struct ra_stream_table_rx_fpga fpga;
+	const u32 *words = (const u32 *)&fpga;
+
+	ra_stream_table_rx_stream_read(sttb, &fpga, index);
+
+	fpga.misc_control &= ~RA_STREAM_TABLE_RX_MISC_EXEC_HASH;
+
+	if (active)
+		fpga.misc_control |= RA_STREAM_TABLE_RX_MISC_ACT;
+	else
+		fpga.misc_control &= ~RA_STREAM_TABLE_RX_MISC_ACT;
+
+	ra_stream_table_rx_word_write(sttb, index, RA_STREAM_TABLE_RX_CTRL_WORD,
+				      words[RA_STREAM_TABLE_RX_CTRL_WORD]);
+}
+
+/*
+ * Points a live entry at a new track table range. trtp_base_addr is
+ * changed with a single word write, so the stream keeps running.
+ */
+void ra_stream_table_rx_set_trtb_index(struct ra_stream_table_rx *sttb,
+				       int index, int trtb_index)
+{
+	struct ra_stream_table_rx_fpga fpga;
+	const u32 *words = (const u32 *)&fpga;
+	int word = offsetof(struct ra_stream_table_rx_fpga, trtp_base_addr) /
+		   sizeof(u32);
+
+	ra_stream_table_rx_stream_read(sttb, &fpga, index);
+	fpga.trtp_base_addr = trtb_index;
+
+	ra_stream_table_rx_word_write(sttb, index, word, words[word]);
+}
+
+/*
+ * Reconstructs the stream of a valid entry from the shadow copy, which holds
+ * what the hardware contained at probe time when entries were adopted. The
+ * tracks are left to the caller. Returns -ENOENT for invalid entries.
+ */
+int ra_stream_table_rx_get(struct ra_stream_table_rx *sttb,
+			   struct ra_sd_rx_stream *stream,
+			   int index, int *trtb_index)
+{
+	struct ra_stream_table_rx_fpga fpga;
+	int codec;
+
+	ra_stream_table_rx_stream_read(sttb, &fpga, index);
+
+	if (!(fpga.misc_control & RA_STREAM_TABLE_RX_MISC_VLD))
+		return -ENOENT;
+
+	codec = ra_sd_codec_from_fpga_code(fpga.codec);
+	if (codec < 0)
+		return codec;
+
+	memset(stream, 0, sizeof(*stream));
+
+	stream->primary.destination_ip =
+		cpu_to_be32(fpga.destination_ip_primary);
+	stream->primary.destination_port =
+		cpu_to_be16(fpga.destination_port_primary);
+
+	/*
+	 * Non-redundant streams have their interface duplicated, see
+	 * ra_stream_table_rx_fill(). Either way, filling the entry again
+	 * yields the same words.
+	 */
+	if (fpga.destination_ip_secondary != fpga.destination_ip_primary ||
+	    fpga.destination_port_secondary != fpga.destination_port_primary) {
+		stream->secondary.destination_ip =
+			cpu_to_be32(fpga.destination_ip_secondary);
+		stream->secondary.destination_port =
+			cpu_to_be16(fpga.destination_port_secondary);
+	}
+
+	stream->num_channels = fpga.num_channels;
+	stream->rtp_offset = fpga.rtp_offset;
+	stream->jitter_buffer_margin = fpga.jitter_buffer_margin;
+	stream->rtp_ssrc = fpga.rtp_ssrc;
+	stream->rtp_payload_type = fpga.rtp_payload_type;
+	stream->vlan_tag = cpu_to_be16(fpga.rtp_filter_vlan_id &
+				       RA_STREAM_TABLE_RX_VLAN_ID);
+	stream->rtp_filter =
+		!!(fpga.rtp_filter_vlan_id & RA_STREAM_TABLE_RX_RTP_FILTER);
+	stream->codec = codec;
+
+	stream->active = !!(fpga.misc_control & RA_STREAM_TABLE_RX_MISC_ACT);
+	stream->sync_source =
+		!!(fpga.misc_control & RA_STREAM_TABLE_RX_MISC_SYNC_SOURCE);
+	stream->vlan_tagged =
+		!!(fpga.misc_control & RA_STREAM_TABLE_RX_MISC_VLAN);
+	stream->hitless_protection =
+		!!(fpga.misc_control & RA_STREAM_TABLE_RX_MISC_HITLESS);
+	stream->synchronous =
+		!!(fpga.misc_control & RA_STREAM_TABLE_RX_MISC_SYNCHRONOUS);
+
+	*trtb_index = fpga.trtp_base_addr;
+
+	return 0;
 }
 
 static void ra_stream_table_rx_reset(struct ra_stream_table_rx *sttb)
@@ -173,6 +352,20 @@ static void ra_stream_table_rx_reset(struct ra_stream_table_rx *sttb)
 		ra_stream_table_rx_stream_write(sttb, &fpga, i);
 }
 
+/* Fills the shadow copy from the hardware, leaving the entries untouched */
+static void ra_stream_table_rx_read_back(struct ra_stream_table_rx *sttb)
+{
+	size_t words = sttb->max_entries * sizeof(*sttb->shadow) / sizeof(u32);
+	int i;
+
+	__ioread32_copy(sttb->shadow, sttb->regs, words);
+
+	/* EXEC_HASH is a trigger, not state */
+	for (i = 0; i < sttb->max_entries; i++)
+		sttb->shadow[i].misc_control &=
+			~RA_STREAM_TABLE_RX_MISC_EXEC_HASH;
+}
+
 void ra_stream_table_rx_dump(struct ra_stream_table_rx *sttb,
 			     struct seq_file *s)
 {
@@ -197,7 +390,8 @@ void ra_stream_table_rx_dump(struct ra_stream_table_rx *sttb,
 
 int ra_stream_table_rx_probe(struct device *dev,
 			     struct device_node *np,
-			     struct ra_stream_table_rx *sttb)
+			     struct ra_stream_table_rx *sttb,
+			     bool adopt)
 {
 	resource_size_t size;
 	struct resource res;
@@ -226,7 +420,15 @@ int ra_stream_table_rx_probe(struct device *dev,
 		return PTR_ERR(sttb->regs);
 	}
 
-	ra_stream_table_rx_reset(sttb);
+	sttb->shadow = devm_kcalloc(dev, sttb->max_entries,
+				    sizeof(*sttb->shadow), GFP_KERNEL);
+	if (!sttb->shadow)
+		return -ENOMEM;
+
+	if (adopt)
+		ra_stream_table_rx_read_back(sttb);
+	else
+		ra_stream_table_rx_reset(sttb);
 
 	dev_info(dev, "RX stream table, %d entries", sttb->max_entries);
 
@@ -6,9 +6,14 @@
 #include <linux/seq_file.h>
 #include <uapi/ravenna/stream-device.h>
 
+struct ra_stream_table_rx_fpga;
+
 struct ra_stream_table_rx {
 	void __iomem	*regs;
 	int		max_entries;
+
+	/* Copy of what was last written to each entry */
+	struct ra_stream_table_rx_fpga *shadow;
 };
 
 void ra_stream_table_rx_set(struct ra_stream_table_rx *sttb,
@@ -18,11 +23,22 @@ void ra_stream_table_rx_set(struct ra_stream_table_rx *sttb,
 void ra_stream_table_rx_del(struct ra_stream_table_rx *sttb,
 			    int index);
 
+void ra_stream_table_rx_set_active(struct ra_stream_table_rx *sttb,
+				   int index, bool active);
+
+void ra_stream_table_rx_set_trtb_index(struct ra_stream_table_rx *sttb,
+				       int index, int trtb_index);
+
+int ra_stream_table_rx_get(struct ra_stream_table_rx *sttb,
+			   struct ra_sd_rx_stream *stream,
+			   int index, int *trtb_index);
+
 void ra_stream_table_rx_dump(struct ra_stream_table_rx *sttb,
 			     struct seq_file *s);
 
 int ra_stream_table_rx_probe(struct device *dev,
 			     struct device_node *np,
-			     struct ra_stream_table_rx *sttb);
+			     struct ra_stream_table_rx *sttb,
+			     bool adopt);
 
 #endif /* RA_SD_STREAM_TABLE_H */
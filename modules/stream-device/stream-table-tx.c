@@ -15,6 +15,9 @@
 #define RA_STREAM_TABLE_TX_MISC_SEC		BIT(1)
 #define RA_STREAM_TABLE_TX_MISC_PRI		BIT(0)
 
+/* Index of the 32-bit word that holds misc_control */
+#define RA_STREAM_TABLE_TX_CTRL_WORD		0
+
 struct ra_stream_table_tx_fpga {
 #ifdef __LITTLE_ENDIAN
 	__u16 trtp_base_addr;			/* 0x00 */
@@ -71,18 +74,54 @@ void ra_stream_table_tx_stream_write(struct ra_stream_table_tx *sttb,
 	BUG_ON(index >= sttb->max_entries);
 
 	__iowrite32_copy(dest, fpga, sizeof(*fpga) / sizeof(u32));
+	memcpy(&sttb->shadow[index], fpga, sizeof(*fpga));
+	cpu_relax();
+}
+
+static inline
+void ra_stream_table_tx_word_write(struct ra_stream_table_tx *sttb,
+				   int index, int word, u32 val)
+{
+	void __iomem *dest = sttb->regs +
+		sizeof(struct ra_stream_table_tx_fpga) * index +
+		sizeof(u32) * word;
+	u32 *shadow = (u32 *)&sttb->shadow[index];
+
+	iowrite32(val, dest);
+	shadow[word] = val;
+}
+
+/*
+ * Only writes the words that differ from the shadow copy. The control word
+ * is always written, and always last, as it carries the VLD bit.
+ */
+static void ra_stream_table_tx_stream_update(struct ra_stream_table_tx *sttb,
+					     struct ra_stream_table_tx_fpga *fpga,
+					     int index)
+{
+	const u32 *old = (const u32 *)&sttb->shadow[index];
+	const u32 *new = (const u32 *)fpga;
+	int i;
+
+	BUG_ON(index >= sttb->max_entries);
+
+	for (i = 0; i < sizeof(*fpga) / sizeof(u32); i++)
+		if (i != RA_STREAM_TABLE_TX_CTRL_WORD && new[i] != old[i])
+			ra_stream_table_tx_word_write(sttb, index, i, new[i]);
+
+	ra_stream_table_tx_word_write(sttb, index, RA_STREAM_TABLE_TX_CTRL_WORD,
+				      new[RA_STREAM_TABLE_TX_CTRL_WORD]);
 	cpu_relax();
 }
 
+/* Entries are read from the shadow copy, the hardware is only read at probe */
 static inline
 void ra_stream_table_tx_stream_read(struct ra_stream_table_tx *sttb,
 				    struct ra_stream_table_tx_fpga *fpga,
 				    int index)
 {
-	void __iomem *src = sttb->regs + sizeof(*fpga) * index;
-
 	BUG_ON(index >= sttb->max_entries);
-	__ioread32_copy(fpga, src, sizeof(*fpga) / sizeof(u32));
+	memcpy(fpga, &sttb->shadow[index], sizeof(*fpga));
 }
 
 static void ra_stream_table_tx_fill(const struct ra_sd_tx_stream *stream,
@@ -166,32 +205,170 @@ void ra_stream_table_tx_set(struct ra_stream_table_tx *sttb,
 			    int ip_total_len,
 			    bool invalidate)
 {
-	struct ra_stream_table_tx_fpga fpga = { 0 };
+	const struct ra_stream_table_tx_fpga *cur = &sttb->shadow[index];
+	struct ra_stream_table_tx_fpga fpga;
 
 	ra_stream_table_tx_fill(stream, &fpga, trtb_index, ip_total_len);
 
-	if (invalidate)
-		ra_stream_table_tx_stream_write(sttb, &fpga, index);
+	/*
+	 * Only a valid entry needs to be invalidated first. The other words
+	 * are then written before the control word, which sets VLD.
+	 */
+	if (invalidate && (cur->misc_control & RA_STREAM_TABLE_TX_MISC_VLD))
+		ra_stream_table_tx_word_write(sttb, index,
+					      RA_STREAM_TABLE_TX_CTRL_WORD, 0);
 
 	fpga.misc_control |=
 		RA_STREAM_TABLE_TX_MISC_VLD;
 
-	ra_stream_table_tx_stream_write(sttb, &fpga, index);
+	ra_stream_table_tx_stream_update(sttb, &fpga, index);
 }
 
 void ra_stream_table_tx_del(struct ra_stream_table_tx *sttb, int index)
 {
 	struct ra_stream_table_tx_fpga fpga = { 0 };
 
-	ra_stream_table_tx_stream_write(sttb, &fpga, index);
+	/* Clear VLD first, then whatever else is left in the entry */
+	ra_stream_table_tx_word_write(sttb, index,
+				      RA_STREAM_TABLE_TX_CTRL_WORD, 0);
+	ra_stream_table_tx_stream_update(sttb, &fpga, index);
+}
+
+/* Toggles the ACT bit of an entry */
+void ra_stream_table_tx_set_active(struct ra_stream_table_tx *sttb,
+				   int index, bool active)
+{
+	struct ra_stream_table_tx_fpga fpga;
+	const u32 *words = (const u32 *)&fpga;
+
+	ra_stream_table_tx_stream_read(sttb, &fpga, index);
+
+	if (active)
+		fpga.misc_control |= RA_STREAM_TABLE_TX_MISC_ACT;
+	else
+		fpga.misc_control &= ~RA_STREAM_TABLE_TX_MISC_ACT;
+
+	ra_stream_table_tx_word_write(sttb, index, RA_STREAM_TABLE_TX_CTRL_WORD,
+				      words[RA_STREAM_TABLE_TX_CTRL_WORD]);
+}
+
+/*
+ * Points a live entry at a new track table range. trtp_base_addr is
+ * changed with a single word write, so the stream keeps running.
+ */
+void ra_stream_table_tx_set_trtb_index(struct ra_stream_table_tx *sttb,
+				       int index, int trtb_index)
+{
+	struct ra_stream_table_tx_fpga fpga;
+	const u32 *words = (const u32 *)&fpga;
+	int word = offsetof(struct ra_stream_table_tx_fpga, trtp_base_addr) /
+		   sizeof(u32);
+
+	ra_stream_table_tx_stream_read(sttb, &fpga, index);
+	fpga.trtp_base_addr = trtb_index;
+
+	ra_stream_table_tx_word_write(sttb, index, word, words[word]);
+}
+
+static void ra_stream_table_tx_get_mac(u8 *mac, u32 msb, u16 lsb)
+{
+	mac[0] = msb >> 24;
+	mac[1] = msb >> 16;
+	mac[2] = msb >> 8;
+	mac[3] = msb >> 0;
+	mac[4] = lsb >> 8;
+	mac[5] = lsb >> 0;
+}
+
+/*
+ * Reconstructs the stream of a valid entry from the shadow copy, which holds
+ * what the hardware contained at probe time when entries were adopted. The
+ * tracks are left to the caller. Returns -ENOENT for invalid entries.
+ */
+int ra_stream_table_tx_get(struct ra_stream_table_tx *sttb,
+			   struct ra_sd_tx_stream *stream,
+			   int index, int *trtb_index)
+{
+	struct ra_sd_tx_stream_interface *pri = &stream->primary;
+	struct ra_sd_tx_stream_interface *sec = &stream->secondary;
+	struct ra_stream_table_tx_fpga fpga;
+	int codec;
+
+	ra_stream_table_tx_stream_read(sttb, &fpga, index);
+
+	if (!(fpga.misc_control & RA_STREAM_TABLE_TX_MISC_VLD))
+		return -ENOENT;
+
+	codec = ra_sd_codec_from_fpga_code(fpga.codec);
+	if (codec < 0)
+		return codec;
+
+	memset(stream, 0, sizeof(*stream));
+
+	stream->active = !!(fpga.misc_control & RA_STREAM_TABLE_TX_MISC_ACT);
+	stream->vlan_tagged =
+		!!(fpga.misc_control & RA_STREAM_TABLE_TX_MISC_VLAN);
+	stream->multicast =
+		!!(fpga.misc_control & RA_STREAM_TABLE_TX_MISC_MULTICAST);
+	stream->use_primary =
+		!!(fpga.misc_control & RA_STREAM_TABLE_TX_MISC_PRI);
+	stream->use_secondary =
+		!!(fpga.misc_control & RA_STREAM_TABLE_TX_MISC_SEC);
+
+	stream->codec = codec;
+	stream->num_channels = fpga.num_channels;
+	stream->num_samples = fpga.num_samples;
+
+	pri->destination_ip = cpu_to_be32(fpga.destination_ip_primary);
+	sec->destination_ip = cpu_to_be32(fpga.destination_ip_secondary);
+	pri->source_ip = cpu_to_be32(fpga.source_ip_primary);
+	sec->source_ip = cpu_to_be32(fpga.source_ip_secondary);
+
+	pri->source_port = cpu_to_be16(fpga.source_port_primary);
+	sec->source_port = cpu_to_be16(fpga.source_port_secondary);
+	pri->destination_port = cpu_to_be16(fpga.destination_port_primary);
+	sec->destination_port = cpu_to_be16(fpga.destination_port_secondary);
+
+	ra_stream_table_tx_get_mac(pri->destination_mac,
+				   fpga.destination_mac_primary_msb,
+				   fpga.destination_mac_primary_lsb);
+	ra_stream_table_tx_get_mac(sec->destination_mac,
+				   fpga.destination_mac_secondary_msb,
+				   fpga.destination_mac_secondary_lsb);
+
+	pri->vlan_tag = cpu_to_be16(fpga.vlan_tag_primary);
+	sec->vlan_tag = cpu_to_be16(fpga.vlan_tag_secondary);
+
+	stream->ttl = fpga.ttl;
+	stream->dscp_tos = fpga.dscp_tos;
+
+	stream->next_rtp_sequence_num = fpga.next_rtp_sequence_num;
+	stream->rtp_payload_type = fpga.rtp_payload_type;
+	stream->next_rtp_tx_time = fpga.next_rtp_tx_time;
+
+	stream->rtp_offset = fpga.rtp_offset;
+	stream->rtp_ssrc = fpga.rtp_ssrc;
+
+	*trtb_index = fpga.trtp_base_addr;
+
+	return 0;
 }
 
 static void ra_stream_table_tx_reset(struct ra_stream_table_tx *sttb)
 {
+	struct ra_stream_table_tx_fpga fpga = { 0 };
 	int i;
 
 	for (i = 0; i < sttb->max_entries; i++)
-		ra_stream_table_tx_del(sttb, i);
+		ra_stream_table_tx_stream_write(sttb, &fpga, i);
+}
+
+/* Fills the shadow copy from the hardware, leaving the entries untouched */
+static void ra_stream_table_tx_read_back(struct ra_stream_table_tx *sttb)
+{
+	size_t words = sttb->max_entries * sizeof(*sttb->shadow) / sizeof(u32);
+
+	__ioread32_copy(sttb->shadow, sttb->regs, words);
 }
 
 void ra_stream_table_tx_dump(struct ra_stream_table_tx *sttb,
@@ -218,7 +395,8 @@ void ra_stream_table_tx_dump(struct ra_stream_table_tx *sttb,
 
 int ra_stream_table_tx_probe(struct device *dev,
 			     struct device_node *np,
-			     struct ra_stream_table_tx *sttb)
+			     struct ra_stream_table_tx *sttb,
+			     bool adopt)
 {
 	resource_size_t size;
 	struct resource res;
@@ -247,7 +425,15 @@ int ra_stream_table_tx_probe(struct device *dev,
 
 	sttb->max_entries = size / sizeof(struct ra_stream_table_tx_fpga);
 
-	ra_stream_table_tx_reset(sttb);
+	sttb->shadow = devm_kcalloc(dev, sttb->max_entries,
+				    sizeof(*sttb->shadow), GFP_KERNEL);
+	if (!sttb->shadow)
+		return -ENOMEM;
+
+	if (adopt)
+		ra_stream_table_tx_read_back(sttb);
+	else
+		ra_stream_table_tx_reset(sttb);
 
 	dev_info(dev, "TX stream table, %d entries", sttb->max_entries);
 
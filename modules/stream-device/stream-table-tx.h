@@ -6,9 +6,14 @@
 #include <linux/seq_file.h>
 #include <uapi/ravenna/stream-device.h>
 
+struct ra_stream_table_tx_fpga;
+
 struct ra_stream_table_tx {
 	void __iomem	*regs;
 	int		max_entries;
+
+	/* Copy of what was last written to each entry */
+	struct ra_stream_table_tx_fpga *shadow;
 };
 
 void ra_stream_table_tx_set(struct ra_stream_table_tx *sttb,
@@ -20,11 +25,22 @@ void ra_stream_table_tx_set(struct ra_stream_table_tx *sttb,
 void ra_stream_table_tx_del(struct ra_stream_table_tx *sttb,
 			    int index);
 
+void ra_stream_table_tx_set_active(struct ra_stream_table_tx *sttb,
+				   int index, bool active);
+
+void ra_stream_table_tx_set_trtb_index(struct ra_stream_table_tx *sttb,
+				       int index, int trtb_index);
+
+int ra_stream_table_tx_get(struct ra_stream_table_tx *sttb,
+			   struct ra_sd_tx_stream *stream,
+			   int index, int *trtb_index);
+
 void ra_stream_table_tx_dump(struct ra_stream_table_tx *sttb,
 			     struct seq_file *s);
 
 int ra_stream_table_tx_probe(struct device *dev,
 			     struct device_node *np,
-			     struct ra_stream_table_tx *sttb);
+			     struct ra_stream_table_tx *sttb,
+			     bool adopt);
 
 #endif /* RA_SD_STREAM_TABLE_H */
@@ -3,22 +3,78 @@
 #include <linux/device.h>
 #include <linux/of_address.h>
 
+#include <uapi/ravenna/types.h>
+
 #include "track-table.h"
 
-int ra_track_table_alloc(struct ra_track_table *trtb, int n_channels)
+/*
+ * Reserves a continuous area in @used, which is either the allocation bitmap
+ * of the track table or a snapshot of it. The smallest free run that fits is
+ * used, so large runs stay available for large streams.
+ */
+int ra_track_table_reserve(struct ra_track_table *trtb, unsigned long *used,
+			   int n_channels)
 {
-	unsigned long start;
+	unsigned int start, end, best = 0, best_len = UINT_MAX;
 
-	/* Allocate a continuous area in the track table */
-	start = bitmap_find_next_zero_area(trtb->used_entries,
-					   trtb->max_entries,
-					   0, n_channels, 0);
-	if (start >= trtb->max_entries)
+	for_each_clear_bitrange(start, end, used, trtb->max_entries) {
+		unsigned int len = end - start;
+
+		if (len >= n_channels && len < best_len) {
+			best = start;
+			best_len = len;
+
+			if (len == n_channels)
+				break;
+		}
+	}
+
+	if (best_len == UINT_MAX)
+		return -ENOSPC;
+
+	bitmap_set(used, best, n_channels);
+
+	return best;
+}
+
+/*
+ * Grows the area at @index from @old_n to @new_n entries in place, if the
+ * entries following it are free.
+ */
+int ra_track_table_grow(struct ra_track_table *trtb, unsigned long *used,
+			int index, int old_n, int new_n)
+{
+	if (index + new_n > trtb->max_entries)
 		return -ENOSPC;
 
-	bitmap_set(trtb->used_entries, start, n_channels);
+	if (find_next_bit(used, index + new_n, index + old_n) < index + new_n)
+		return -ENOSPC;
+
+	bitmap_set(used, index + old_n, new_n - old_n);
+
+	return 0;
+}
+
+int ra_track_table_alloc(struct ra_track_table *trtb, int n_channels)
+{
+	/* Allocate a continuous area in the track table */
+	return ra_track_table_reserve(trtb, trtb->used_entries, n_channels);
+}
+
+/*
+ * Makes @used the new allocation bitmap. Entries which are no longer in use
+ * are muted.
+ */
+void ra_track_table_commit(struct ra_track_table *trtb,
+			   const unsigned long *used)
+{
+	int i;
+
+	for_each_set_bit(i, trtb->used_entries, trtb->max_entries)
+		if (!test_bit(i, used))
+			ra_track_table_write(trtb, i, RA_TRACK_TABLE_MUTE);
 
-	return start;
+	bitmap_copy(trtb->used_entries, used, trtb->max_entries);
 }
 
 void ra_track_table_set(struct ra_track_table *trtb,
@@ -27,10 +83,23 @@ void ra_track_table_set(struct ra_track_table *trtb,
 {
 	int i;
 
+	for (i = 0; i < n_channels; i++)
+		ra_track_table_write(trtb, index+i,
+				     ra_track_table_value(tracks[i]));
+}
+
+/* Only writes the entries whose mapping differs between @old and @new */
+void ra_track_table_update(struct ra_track_table *trtb,
+			   int index, int n_channels,
+			   const s16 *old, const s16 *new)
+{
+	int i;
+
 	for (i = 0; i < n_channels; i++) {
-		u32 v = tracks[i] >= 0 ? tracks[i] : RA_TRACK_TABLE_MUTE;
+		u32 v = ra_track_table_value(new[i]);
 
-		ra_track_table_write(trtb, index+i, v);
+		if (ra_track_table_value(old[i]) != v)
+			ra_track_table_write(trtb, index+i, v);
 	}
 }
 
@@ -45,6 +114,48 @@ void ra_track_table_free(struct ra_track_table *trtb,
 	bitmap_clear(trtb->used_entries, index, n_channels);
 }
 
+void ra_track_table_show_free_runs(struct ra_track_table *trtb,
+				   struct seq_file *s)
+{
+	unsigned int hist[BITS_PER_TYPE(int)] = { 0 };
+	unsigned int start, end, largest = 0, runs = 0;
+	int i;
+
+	for_each_clear_bitrange(start, end, trtb->used_entries,
+				trtb->max_entries) {
+		unsigned int len = end - start;
+
+		largest = max(largest, len);
+		hist[fls(len) - 1]++;
+		runs++;
+	}
+
+	seq_printf(s, "Largest free run: %u\n", largest);
+	seq_printf(s, "Free runs: %u\n", runs);
+
+	for (i = 0; i < ARRAY_SIZE(hist); i++)
+		if (hist[i])
+			seq_printf(s, "  %u-%u: %u\n",
+				   1U << i, (2U << i) - 1, hist[i]);
+}
+
+/* Reads back the mapping of an area, e.g. one adopted at probe time */
+void ra_track_table_get(struct ra_track_table *trtb,
+			int index, int n_channels, s16 *tracks)
+{
+	int i;
+
+	for (i = 0; i < n_channels; i++) {
+		u32 v = ra_track_table_read(trtb, index+i);
+
+		/* Values out of range are left for the caller to reject */
+		if (v & RA_TRACK_TABLE_MUTE)
+			tracks[i] = RA_NULL_TRACK;
+		else
+			tracks[i] = min_t(u32, v, S16_MAX);
+	}
+}
+
 static void ra_track_table_reset(struct ra_track_table *trtb)
 {
 	int i;
@@ -57,7 +168,8 @@ static void ra_track_table_reset(struct ra_track_table *trtb)
 
 int ra_track_table_probe(struct device *dev,
 			 struct device_node *np,
-			 struct ra_track_table *trtb)
+			 struct ra_track_table *trtb,
+			 bool adopt)
 {
 	resource_size_t size;
 	struct resource res;
@@ -88,7 +200,12 @@ int ra_track_table_probe(struct device *dev,
 	if (!trtb->used_entries)
 		return -ENOMEM;
 
-	ra_track_table_reset(trtb);
+	/*
+	 * When adopting, the used entries are claimed by the streams found in
+	 * the stream table, and the others are written on allocation.
+	 */
+	if (!adopt)
+		ra_track_table_reset(trtb);
 
 	return 0;
 }
@@ -21,6 +21,11 @@ static inline void ra_track_table_write(struct ra_track_table *trtb,
 	iowrite32(val, trtb->regs + (index * sizeof(u32)));
 }
 
+static inline u32 ra_track_table_value(s16 track)
+{
+	return track >= 0 ? track : RA_TRACK_TABLE_MUTE;
+}
+
 static inline u32 ra_track_table_read(struct ra_track_table *trtb, int index)
 {
 	BUG_ON(index >= trtb->max_entries);
@@ -44,13 +49,27 @@ static inline int ra_stream_find_used_track(int start, int n_channels,
 	     i < (n_channels);						\
 	     i = ra_stream_find_used_track((i) + 1, (n_channels), (tracks)))
 
+int ra_track_table_reserve(struct ra_track_table *trtb, unsigned long *used,
+			   int n_channels);
+int ra_track_table_grow(struct ra_track_table *trtb, unsigned long *used,
+			int index, int old_n, int new_n);
 int ra_track_table_alloc(struct ra_track_table *trtb, int n_channels);
+void ra_track_table_commit(struct ra_track_table *trtb,
+			   const unsigned long *used);
 void ra_track_table_set(struct ra_track_table *trtb,
 			int index, int n_channels, const s16 *tracks);
+void ra_track_table_update(struct ra_track_table *trtb,
+			   int index, int n_channels,
+			   const s16 *old, const s16 *new);
+void ra_track_table_get(struct ra_track_table *trtb,
+			int index, int n_channels, s16 *tracks);
 void ra_track_table_free(struct ra_track_table *trtb,
 			 int n_channels, int trtb_index);
+void ra_track_table_show_free_runs(struct ra_track_table *trtb,
+				   struct seq_file *s);
 int ra_track_table_probe(struct device *dev,
 			 struct device_node *np,
-			 struct ra_track_table *trtb);
+			 struct ra_track_table *trtb,
+			 bool adopt);
 
 #endif /* RA_SD_STREAM_TABLE_H */
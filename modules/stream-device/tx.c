@@ -2,12 +2,14 @@
 
 #define DEBUG 1
 
+#include <linux/capability.h>
 #include <linux/of.h>
+#include <linux/sort.h>
 
 #include "main.h"
 #include "rtp.h"
 
-static struct ra_sd_tx_stream_elem *
+struct ra_sd_tx_stream_elem *
 ra_sd_tx_stream_elem_find_by_index(struct ra_sd_tx *tx, int index)
 {
 	struct ra_sd_tx_stream_elem *e = xa_load(&tx->streams, index);
@@ -31,8 +33,19 @@ ra_sd_tx_validate_stream_interface(const struct ra_sd_tx_stream_interface *iface
 	return 0;
 }
 
-static int ra_sd_tx_validate_stream(struct ra_sd_tx *tx,
-				    const struct ra_sd_tx_stream *stream)
+int ra_sd_tx_stream_ip_length(const struct ra_sd_tx_stream *stream)
+{
+	int codec_len, payload_len;
+
+	codec_len = ra_sd_codec_sample_length(stream->codec);
+	payload_len = stream->num_channels * stream->num_samples * codec_len;
+
+	// 20 bytes IP header + 8 bytes UDP header + 12 bytes RTP header + RTP data
+	return 20 + 8 + 12 + payload_len;
+}
+
+int ra_sd_tx_validate_stream(struct ra_sd_tx *tx,
+			     const struct ra_sd_tx_stream *stream)
 {
 	struct ra_sd_priv *priv = container_of(tx, struct ra_sd_priv, tx);
 	int i, ret;
@@ -70,32 +83,113 @@ static int ra_sd_tx_validate_stream(struct ra_sd_tx *tx,
 	if (stream->codec >= _RA_STREAM_CODEC_MAX)
 		return -EINVAL;
 
-	for (i = 0; i < ARRAY_SIZE(stream->tracks); i++)
+	if (stream->num_channels > RA_MAX_CHANNELS)
+		return -EINVAL;
+
+	for (i = 0; i < stream->num_channels; i++)
 		if (stream->tracks[i] >= (__s16)priv->max_tracks)
 			return -EINVAL;
 
+	if (ra_sd_tx_stream_ip_length(stream) > RA_MAX_ETHERNET_PACKET_SIZE)
+		return -EINVAL;
+
 	return 0;
 }
 
-static int ra_sd_tx_stream_ip_length(const struct ra_sd_tx_stream *stream)
+/* Ethernet header, FCS, preamble and inter-frame gap */
+#define RA_SD_TX_ETH_OVERHEAD		(14 + 4 + 8 + 12)
+#define RA_SD_TX_VLAN_OVERHEAD		4
+
+/*
+ * Wire bandwidth of a stream in bit/s, per interface. The packet rate follows
+ * from the sample rate and the number of samples per packet.
+ */
+static void ra_sd_tx_stream_bandwidth(const struct ra_sd_tx *tx,
+				      const struct ra_sd_tx_stream *stream,
+				      u64 *bps)
 {
-	int codec_len, payload_len;
+	u64 frame_len, rate, bits;
 
-	codec_len = ra_sd_codec_sample_length(stream->codec);
-	payload_len = stream->num_channels * stream->num_samples * codec_len;
+	bps[RA_SD_INTERFACE_PRIMARY] = 0;
+	bps[RA_SD_INTERFACE_SECONDARY] = 0;
 
-	// 20 bytes IP header + 8 bytes UDP header + 12 bytes RTP header + RTP data
-	return 20 + 8 + 12 + payload_len;
+	if (!stream)
+		return;
+
+	frame_len = ra_sd_tx_stream_ip_length(stream) + RA_SD_TX_ETH_OVERHEAD;
+	if (stream->vlan_tagged)
+		frame_len += RA_SD_TX_VLAN_OVERHEAD;
+
+	/* Assume the worst for streams without samples */
+	rate = DIV_ROUND_UP_ULL((u64)tx->sample_rate,
+				max_t(u8, stream->num_samples, 1));
+
+	bits = rate * frame_len * BITS_PER_BYTE;
+
+	if (stream->use_primary)
+		bps[RA_SD_INTERFACE_PRIMARY] = bits;
+
+	if (stream->use_secondary)
+		bps[RA_SD_INTERFACE_SECONDARY] = bits;
 }
 
-int ra_sd_tx_add_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
-			      unsigned int size, void __user *buf)
+/*
+ * Checks whether replacing @old with @new, either of which may be NULL, keeps
+ * @used within the budget of all interfaces. @used is either tx->used_bps or
+ * a snapshot of it, and includes @old. Changes which do not increase the
+ * bandwidth on an interface are always accepted there, even if the budget
+ * has been lowered below the current use. Must be called with tx->mutex held.
+ */
+int ra_sd_tx_bandwidth_check(struct ra_sd_tx *tx, const u64 *used,
+			     const struct ra_sd_tx_stream *old,
+			     const struct ra_sd_tx_stream *new)
 {
-	struct ra_sd_add_tx_stream_cmd cmd;
+	u64 old_bps[2], new_bps[2];
+	int i;
+
+	lockdep_assert_held(&tx->mutex);
+
+	ra_sd_tx_stream_bandwidth(tx, old, old_bps);
+	ra_sd_tx_stream_bandwidth(tx, new, new_bps);
+
+	for (i = 0; i < ARRAY_SIZE(tx->budget_bps); i++) {
+		if (!tx->budget_bps[i] || new_bps[i] <= old_bps[i])
+			continue;
+
+		if (used[i] - old_bps[i] + new_bps[i] > tx->budget_bps[i])
+			return -EDQUOT;
+	}
+
+	return 0;
+}
+
+/* Accounts for replacing @old with @new in @used, see above */
+void ra_sd_tx_bandwidth_update(struct ra_sd_tx *tx, u64 *used,
+			       const struct ra_sd_tx_stream *old,
+			       const struct ra_sd_tx_stream *new)
+{
+	u64 old_bps[2], new_bps[2];
+	int i;
+
+	lockdep_assert_held(&tx->mutex);
+
+	ra_sd_tx_stream_bandwidth(tx, old, old_bps);
+	ra_sd_tx_stream_bandwidth(tx, new, new_bps);
+
+	for (i = 0; i < ARRAY_SIZE(tx->used_bps); i++)
+		used[i] = used[i] - old_bps[i] + new_bps[i];
+}
+
+int ra_sd_tx_set_bandwidth_config_ioctl(struct ra_sd_tx *tx, unsigned int size,
+					void __user *buf)
+{
+	struct ra_sd_set_tx_bandwidth_config_cmd cmd;
 	struct ra_sd_tx_stream_elem *e;
-	int ip_total_len;
-	u32 index;
-	int ret;
+	unsigned long index;
+
+	/* Otherwise, clients could lift their own limits */
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
 
 	if (size != sizeof(cmd))
 		return -EINVAL;
@@ -106,64 +200,202 @@ int ra_sd_tx_add_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 	if (cmd.version != 0)
 		return -EINVAL;
 
-	ret = ra_sd_tx_validate_stream(tx, &cmd.stream);
-	if (ret < 0)
-		return ret;
+	if (cmd.sample_rate == 0)
+		return -EINVAL;
+
+	mutex_lock(&tx->mutex);
+
+	tx->sample_rate = cmd.sample_rate;
+	tx->budget_bps[RA_SD_INTERFACE_PRIMARY] = cmd.primary_budget_bps;
+	tx->budget_bps[RA_SD_INTERFACE_SECONDARY] = cmd.secondary_budget_bps;
+
+	/* The bandwidth of all streams depends on the sample rate */
+	memset(tx->used_bps, 0, sizeof(tx->used_bps));
+	xa_for_each(&tx->streams, index, e)
+		ra_sd_tx_bandwidth_update(tx, tx->used_bps, NULL, &e->stream);
+
+	mutex_unlock(&tx->mutex);
+
+	return 0;
+}
+
+int ra_sd_tx_read_bandwidth_ioctl(struct ra_sd_tx *tx, unsigned int size,
+				  void __user *buf)
+{
+	struct ra_sd_read_tx_bandwidth_cmd cmd;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
 
-	ip_total_len = ra_sd_tx_stream_ip_length(&cmd.stream);
-	if (ip_total_len > RA_MAX_ETHERNET_PACKET_SIZE)
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
 		return -EINVAL;
 
+	mutex_lock(&tx->mutex);
+
+	cmd.sample_rate = tx->sample_rate;
+	cmd.primary.budget_bps = tx->budget_bps[RA_SD_INTERFACE_PRIMARY];
+	cmd.primary.used_bps = tx->used_bps[RA_SD_INTERFACE_PRIMARY];
+	cmd.secondary.budget_bps = tx->budget_bps[RA_SD_INTERFACE_SECONDARY];
+	cmd.secondary.used_bps = tx->used_bps[RA_SD_INTERFACE_SECONDARY];
+
+	mutex_unlock(&tx->mutex);
+
+	if (copy_to_user(buf, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
+struct ra_sd_tx_defrag_entry {
+	struct ra_sd_tx_stream_elem	*e;
+	unsigned long			index;
+};
+
+static int ra_sd_tx_defrag_cmp(const void *a, const void *b)
+{
+	const struct ra_sd_tx_defrag_entry *ea = a, *eb = b;
+
+	return ea->e->trtb_index - eb->e->trtb_index;
+}
+
+/*
+ * Compacts the track table by moving streams, lowest track table index first,
+ * to the lowest free range that does not overlap with their current one. The
+ * new range is filled before the stream table entry is repointed, so streams
+ * keep playing. Returns the number of streams moved.
+ *
+ * Must be called with tx->mutex held.
+ */
+int ra_sd_tx_defrag(struct ra_sd_tx *tx)
+{
+	struct ra_sd_tx_defrag_entry *entries;
+	struct ra_sd_tx_stream_elem *e;
+	unsigned long index, start;
+	int i, n = 0, moved = 0;
+
+	lockdep_assert_held(&tx->mutex);
+
+	entries = kcalloc(tx->sttb.max_entries, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	xa_for_each(&tx->streams, index, e) {
+		entries[n].e = e;
+		entries[n].index = index;
+		n++;
+	}
+
+	sort(entries, n, sizeof(*entries), ra_sd_tx_defrag_cmp, NULL);
+
+	for (i = 0; i < n; i++) {
+		int num_channels;
+
+		e = entries[i].e;
+		num_channels = e->stream.num_channels;
+
+		start = bitmap_find_next_zero_area(tx->trtb.used_entries,
+						   tx->trtb.max_entries,
+						   0, num_channels, 0);
+		if (start + num_channels > e->trtb_index)
+			continue;
+
+		bitmap_set(tx->trtb.used_entries, start, num_channels);
+		ra_track_table_set(&tx->trtb, start, num_channels,
+				   e->stream.tracks);
+		ra_stream_table_tx_set_trtb_index(&tx->sttb, entries[i].index,
+						  start);
+		ra_track_table_free(&tx->trtb, e->trtb_index, num_channels);
+
+		dev_dbg(tx->dev, "Moved TX stream %lu from track table index %d to %lu\n",
+			entries[i].index, e->trtb_index, start);
+
+		e->trtb_index = start;
+		moved++;
+	}
+
+	kfree(entries);
+
+	return moved;
+}
+
+/* Must be called with tx->mutex held, and with a validated stream */
+static int ra_sd_tx_do_add_stream(struct ra_sd_tx *tx, struct file *filp,
+				  const struct ra_sd_tx_stream *stream)
+{
+	struct ra_sd_priv *priv = container_of(tx, struct ra_sd_priv, tx);
+	struct ra_sd_tx_stream_elem *e;
+	u32 index;
+	int ret;
+
+	lockdep_assert_held(&tx->mutex);
+
+	ret = ra_sd_tx_bandwidth_check(tx, tx->used_bps, NULL, stream);
+	if (ret < 0)
+		return ret;
+
 	e = kzalloc(sizeof(*e), GFP_KERNEL);
 	if (!e)
 		return -ENOMEM;
 
 	e->filp = filp;
 	e->pid = get_pid(task_pid(current));
-	memcpy(&e->stream, &cmd.stream, sizeof(e->stream));
-
-	mutex_lock(&tx->mutex);
+	memcpy(&e->stream, stream, sizeof(e->stream));
 
 	ret = xa_alloc(&tx->streams, &index, e,
 		       XA_LIMIT(0, tx->sttb.max_entries-1), GFP_KERNEL);
 	if (ret < 0) {
 		dev_err(tx->dev, "xa_alloc() failed: %d\n", ret);
-		goto out_unlock;
+		goto out_free;
 	}
 
 	ret = ra_track_table_alloc(&tx->trtb, e->stream.num_channels);
 	if (ret < 0) {
 		dev_err(tx->dev, "ra_track_table_alloc() failed: %d\n", ret);
 		xa_erase(&tx->streams, index);
-		goto out_unlock;
+		ra_sd_rtcp_tx_forget(priv, index);
+		goto out_free;
 	}
 
 	e->trtb_index = ret;
 
 	ra_track_table_set(&tx->trtb, e->trtb_index,
 			   e->stream.num_channels, e->stream.tracks);
-	ra_stream_table_tx_set(&tx->sttb, &e->stream,
-				index, e->trtb_index, ip_total_len, true);
+	ra_stream_table_tx_set(&tx->sttb, &e->stream, index, e->trtb_index,
+			       ra_sd_tx_stream_ip_length(&e->stream), true);
+	ra_sd_tx_bandwidth_update(tx, tx->used_bps, NULL, &e->stream);
 
 	dev_dbg(tx->dev, "Added TX stream with index %d", index);
 
-out_unlock:
-	mutex_unlock(&tx->mutex);
+	return index;
 
-	if (ret < 0) {
-		kfree(e);
-		return ret;
-	}
+out_free:
+	put_pid(e->pid);
+	kfree(e);
 
-	return index;
+	return ret;
 }
 
-int ra_sd_tx_update_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
-				 unsigned int size, void __user *buf)
+int ra_sd_tx_add_stream(struct ra_sd_tx *tx, struct file *filp,
+			const struct ra_sd_tx_stream *stream)
 {
-	struct ra_sd_update_tx_stream_cmd cmd;
-	struct ra_sd_tx_stream_elem *e;
-	int ip_total_len;
+	int ret;
+
+	ret = ra_sd_tx_do_add_stream(tx, filp, stream);
+
+	/* The track table may just be too fragmented */
+	if (ret == -ENOSPC && ra_sd_tx_defrag(tx) > 0)
+		ret = ra_sd_tx_do_add_stream(tx, filp, stream);
+
+	return ret;
+}
+
+int ra_sd_tx_add_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
+			      unsigned int size, void __user *buf)
+{
+	struct ra_sd_add_tx_stream_cmd cmd;
 	int ret;
 
 	if (size != sizeof(cmd))
@@ -179,32 +411,59 @@ int ra_sd_tx_update_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 	if (ret < 0)
 		return ret;
 
-	ip_total_len = ra_sd_tx_stream_ip_length(&cmd.stream);
-	if (ip_total_len > RA_MAX_ETHERNET_PACKET_SIZE)
-		return -EINVAL;
-
 	mutex_lock(&tx->mutex);
+	ret = ra_sd_tx_add_stream(tx, filp, &cmd.stream);
+	mutex_unlock(&tx->mutex);
 
-	e = ra_sd_tx_stream_elem_find_by_index(tx, cmd.index);
-	if (!e) {
-		ret = -ENOENT;
-		goto out_unlock;
-	}
+	return ret;
+}
+
+/* Must be called with tx->mutex held, and with a validated stream */
+static int ra_sd_tx_do_update_stream(struct ra_sd_tx *tx, struct file *filp,
+				     u32 index,
+				     const struct ra_sd_tx_stream *stream)
+{
+	struct ra_sd_tx_stream_elem *e;
+	int ret;
+
+	lockdep_assert_held(&tx->mutex);
+
+	e = ra_sd_tx_stream_elem_find_by_index(tx, index);
+	if (!e)
+		return -ENOENT;
 
 	/* Streams can only be updated by their creators */
-	if (e->filp != filp) {
-		ret = -EACCES;
-		goto out_unlock;
-	}
+	if (e->filp != filp)
+		return -EACCES;
+
+	ret = ra_sd_tx_bandwidth_check(tx, tx->used_bps, &e->stream, stream);
+	if (ret < 0)
+		return ret;
 
-	if (e->stream.num_channels != cmd.stream.num_channels) {
+	if (e->stream.num_channels != stream->num_channels) {
 		/*
-		* If the number of channels changes, we need to free the current
-		* track table allocation and reserve a new range of tracks.
+		* If the number of channels changes, try to shrink or grow the
+		* current track table allocation in place. Otherwise, we need to
+		* free it and reserve a new range of tracks.
 		*/
-		ra_track_table_free(&tx->trtb, e->trtb_index,
-				    e->stream.num_channels);
-		ret = ra_track_table_alloc(&tx->trtb, cmd.stream.num_channels);
+		if (stream->num_channels < e->stream.num_channels) {
+			ra_track_table_free(&tx->trtb,
+					    e->trtb_index + stream->num_channels,
+					    e->stream.num_channels -
+					    stream->num_channels);
+			ret = e->trtb_index;
+		} else if (ra_track_table_grow(&tx->trtb, tx->trtb.used_entries,
+					       e->trtb_index,
+					       e->stream.num_channels,
+					       stream->num_channels) == 0) {
+			ret = e->trtb_index;
+		} else {
+			ra_track_table_free(&tx->trtb, e->trtb_index,
+					    e->stream.num_channels);
+			ret = ra_track_table_alloc(&tx->trtb,
+						   stream->num_channels);
+		}
+
 		if (ret < 0) {
 			int aret = ret;
 
@@ -218,32 +477,74 @@ int ra_sd_tx_update_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 			 * valid before.
 			 */
 			if (WARN_ON(ret < 0))
-				goto out_unlock;
+				return ret;
 
 			e->trtb_index = ret;
 			ra_track_table_set(&tx->trtb, e->trtb_index,
 					   e->stream.num_channels,
 					   e->stream.tracks);
 			ra_stream_table_tx_set(&tx->sttb, &e->stream,
-					       cmd.index, e->trtb_index,
+					       index, e->trtb_index,
 					       ra_sd_tx_stream_ip_length(&e->stream),
 					       false);
 
-			ret = aret;
-			goto out_unlock;
+			return aret;
 		}
 
 		e->trtb_index = ret;
+		ra_track_table_set(&tx->trtb, e->trtb_index,
+				   stream->num_channels, stream->tracks);
+	} else {
+		/* Only touch the entries whose mapping changed */
+		ra_track_table_update(&tx->trtb, e->trtb_index,
+				      stream->num_channels,
+				      e->stream.tracks, stream->tracks);
 	}
 
-	memcpy(&e->stream, &cmd.stream, sizeof(e->stream));
+	ra_sd_tx_bandwidth_update(tx, tx->used_bps, &e->stream, stream);
+	memcpy(&e->stream, stream, sizeof(e->stream));
 
-	ra_track_table_set(&tx->trtb, e->trtb_index,
-			   e->stream.num_channels, e->stream.tracks);
-	ra_stream_table_tx_set(&tx->sttb, &e->stream, cmd.index,
-			       e->trtb_index, ip_total_len, false);
+	ra_stream_table_tx_set(&tx->sttb, &e->stream, index, e->trtb_index,
+			       ra_sd_tx_stream_ip_length(&e->stream), false);
+
+	return 0;
+}
+
+int ra_sd_tx_update_stream(struct ra_sd_tx *tx, struct file *filp,
+			   u32 index, const struct ra_sd_tx_stream *stream)
+{
+	int ret;
+
+	ret = ra_sd_tx_do_update_stream(tx, filp, index, stream);
+
+	/* The track table may just be too fragmented */
+	if (ret == -ENOSPC && ra_sd_tx_defrag(tx) > 0)
+		ret = ra_sd_tx_do_update_stream(tx, filp, index, stream);
+
+	return ret;
+}
+
+int ra_sd_tx_update_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
+				 unsigned int size, void __user *buf)
+{
+	struct ra_sd_update_tx_stream_cmd cmd;
+	int ret;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	ret = ra_sd_tx_validate_stream(tx, &cmd.stream);
+	if (ret < 0)
+		return ret;
 
-out_unlock:
+	mutex_lock(&tx->mutex);
+	ret = ra_sd_tx_update_stream(tx, filp, cmd.index, &cmd.stream);
 	mutex_unlock(&tx->mutex);
 
 	return ret;
@@ -253,20 +554,72 @@ static void ra_sd_tx_free_stream(struct ra_sd_tx *tx,
 				 struct ra_sd_tx_stream_elem *e,
 				 int index)
 {
+	struct ra_sd_priv *priv = container_of(tx, struct ra_sd_priv, tx);
+
 	dev_dbg(tx->dev, "Deleting TX stream %d", index);
 
 	ra_track_table_free(&tx->trtb, e->trtb_index, e->stream.num_channels);
 	ra_stream_table_tx_del(&tx->sttb, index);
+	ra_sd_tx_bandwidth_update(tx, tx->used_bps, &e->stream, NULL);
 	xa_erase(&tx->streams, index);
+	ra_sd_rtcp_tx_forget(priv, index);
 	put_pid(e->pid);
 	kfree(e);
 }
 
+/* Must be called with tx->mutex held */
+int ra_sd_tx_delete_stream(struct ra_sd_tx *tx, struct file *filp, u32 index)
+{
+	struct ra_sd_tx_stream_elem *e;
+
+	lockdep_assert_held(&tx->mutex);
+
+	e = ra_sd_tx_stream_elem_find_by_index(tx, index);
+	if (!e) {
+		dev_dbg(tx->dev, "Failed to find TX stream with index %d",
+			index);
+		return -ENOENT;
+	}
+
+	/* Streams can only be torn down by their creators */
+	if (e->filp != filp)
+		return -EACCES;
+
+	ra_sd_tx_free_stream(tx, e, index);
+
+	return 0;
+}
+
 int ra_sd_tx_delete_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 				 unsigned int size, void __user *buf)
 {
 	struct ra_sd_delete_tx_stream_cmd cmd;
+	int ret;
+
+	if (size != sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, buf, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.version != 0)
+		return -EINVAL;
+
+	mutex_lock(&tx->mutex);
+	ret = ra_sd_tx_delete_stream(tx, filp, cmd.index);
+	mutex_unlock(&tx->mutex);
+
+	return ret;
+}
+
+int ra_sd_tx_list_streams_ioctl(struct ra_sd_tx *tx, unsigned int size,
+				void __user *buf)
+{
+	struct ra_sd_tx_stream_record *records, *r;
+	struct ra_sd_list_streams_cmd cmd;
 	struct ra_sd_tx_stream_elem *e;
+	unsigned long index;
+	u32 n = 0;
 	int ret = 0;
 
 	if (size != sizeof(cmd))
@@ -278,26 +631,44 @@ int ra_sd_tx_delete_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 	if (cmd.version != 0)
 		return -EINVAL;
 
+	if (cmd.num_records > RA_SD_LIST_MAX_RECORDS)
+		return -EINVAL;
+
+	records = kvcalloc(cmd.num_records, sizeof(*records), GFP_KERNEL);
+	if (!records)
+		return -ENOMEM;
+
+	cmd.num_streams = 0;
+
 	mutex_lock(&tx->mutex);
 
-	e = ra_sd_tx_stream_elem_find_by_index(tx, cmd.index);
-	if (!e) {
-		dev_dbg(tx->dev, "Failed to find TX stream with index %d",
-			cmd.index);
-		ret = -ENOENT;
-		goto out_unlock;
+	xa_for_each(&tx->streams, index, e) {
+		cmd.num_streams++;
+
+		if (n == cmd.num_records)
+			continue;
+
+		r = &records[n++];
+		r->index = index;
+		r->owner_pid = pid_vnr(e->pid);
+		r->primary = e->stream.primary;
+		r->secondary = e->stream.secondary;
+		r->num_channels = e->stream.num_channels;
+		r->codec = e->stream.codec;
+		r->active = e->stream.active;
+		r->trtb_index = e->trtb_index;
 	}
 
-	/* Streams can only be torn down by their creators */
-	if (e->filp != filp) {
-		ret = -EACCES;
-		goto out_unlock;
-	}
+	mutex_unlock(&tx->mutex);
 
-	ra_sd_tx_free_stream(tx, e, cmd.index);
+	cmd.num_records = n;
 
-out_unlock:
-	mutex_unlock(&tx->mutex);
+	if (copy_to_user(u64_to_user_ptr(cmd.records), records,
+			 array_size(n, sizeof(*records))) ||
+	    copy_to_user(buf, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+	kvfree(records);
 
 	return ret;
 }
@@ -319,13 +690,161 @@ int ra_sd_tx_delete_streams(struct ra_sd_tx *tx, struct file *filp)
 	return 0;
 }
 
+/*
+ * Hands all streams owned by @from and @from_token over to @to and @to_token.
+ * A NULL file denotes detached streams, which are only kept alive by their
+ * token. Returns the number of streams transferred.
+ */
+int ra_sd_tx_transfer_streams(struct ra_sd_tx *tx, struct file *from,
+			     u64 from_token, struct file *to, u64 to_token)
+{
+	struct ra_sd_tx_stream_elem *e;
+	unsigned long index;
+	int n = 0;
+
+	mutex_lock(&tx->mutex);
+
+	xa_for_each(&tx->streams, index, e) {
+		if (e->filp != from || e->token != from_token)
+			continue;
+
+		put_pid(e->pid);
+		e->pid = to ? get_pid(task_pid(current)) : NULL;
+		e->filp = to;
+		e->token = to_token;
+		n++;
+	}
+
+	mutex_unlock(&tx->mutex);
+
+	return n;
+}
+
+/*
+ * Registers the entry at @index, as found in the hardware at probe time, as
+ * a detached stream. Returns -ENOENT if the entry is not valid.
+ */
+static int ra_sd_tx_adopt_stream(struct ra_sd_tx *tx, u32 index)
+{
+	struct ra_sd_tx_stream_elem *e;
+	int trtb_index, n, ret;
+
+	lockdep_assert_held(&tx->mutex);
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+
+	ret = ra_stream_table_tx_get(&tx->sttb, &e->stream, index, &trtb_index);
+	if (ret < 0)
+		goto out_free;
+
+	n = e->stream.num_channels;
+
+	if (n > RA_MAX_CHANNELS ||
+	    trtb_index + n > tx->trtb.max_entries ||
+	    find_next_bit(tx->trtb.used_entries, trtb_index + n,
+			  trtb_index) < trtb_index + n) {
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	ra_track_table_get(&tx->trtb, trtb_index, n, e->stream.tracks);
+
+	ret = ra_sd_tx_validate_stream(tx, &e->stream);
+	if (ret < 0)
+		goto out_free;
+
+	ret = xa_insert(&tx->streams, index, e, GFP_KERNEL);
+	if (ret < 0)
+		goto out_free;
+
+	e->trtb_index = trtb_index;
+	e->token = RA_SD_TOKEN_ADOPTED;
+
+	bitmap_set(tx->trtb.used_entries, trtb_index, n);
+	ra_sd_tx_bandwidth_update(tx, tx->used_bps, NULL, &e->stream);
+
+	return 0;
+
+out_free:
+	kfree(e);
+
+	return ret;
+}
+
+/*
+ * Takes over the streams which were left running in the hardware, as
+ * detached streams with the token RA_SD_TOKEN_ADOPTED. Entries which are not
+ * consistent are deleted.
+ */
+int ra_sd_tx_adopt_streams(struct ra_sd_tx *tx)
+{
+	int i, n = 0, ret = 0;
+
+	mutex_lock(&tx->mutex);
+
+	for (i = 0; i < tx->sttb.max_entries; i++) {
+		ret = ra_sd_tx_adopt_stream(tx, i);
+		if (ret == -ENOENT)
+			continue;
+
+		if (ret == -ENOMEM)
+			break;
+
+		if (ret < 0) {
+			dev_warn(tx->dev, "Not adopting TX stream %d: %d\n",
+				 i, ret);
+			ra_stream_table_tx_del(&tx->sttb, i);
+			continue;
+		}
+
+		n++;
+	}
+
+	mutex_unlock(&tx->mutex);
+
+	if (ret == -ENOMEM)
+		return ret;
+
+	dev_info(tx->dev, "Adopted %d TX streams\n", n);
+
+	return 0;
+}
+
+/*
+ * Frees all detached streams, but leaves them running in the hardware for
+ * the next instance of the driver to adopt.
+ */
+void ra_sd_tx_abandon_streams(struct ra_sd_tx *tx)
+{
+	struct ra_sd_priv *priv = container_of(tx, struct ra_sd_priv, tx);
+	struct ra_sd_tx_stream_elem *e;
+	unsigned long index;
+
+	mutex_lock(&tx->mutex);
+
+	xa_for_each(&tx->streams, index, e) {
+		if (e->filp)
+			continue;
+
+		ra_sd_tx_bandwidth_update(tx, tx->used_bps, &e->stream, NULL);
+		xa_erase(&tx->streams, index);
+		ra_sd_rtcp_tx_forget(priv, index);
+		put_pid(e->pid);
+		kfree(e);
+	}
+
+	mutex_unlock(&tx->mutex);
+}
+
 static void ra_sd_tx_destroy_streams(void *xa)
 {
 	BUG_ON(!xa_empty(xa));
 	xa_destroy(xa);
 }
 
-int ra_sd_tx_probe(struct ra_sd_tx *tx, struct device *dev)
+int ra_sd_tx_probe(struct ra_sd_tx *tx, struct device *dev, bool adopt)
 {
 	struct device_node *child_node;
 	int ret;
@@ -339,7 +858,7 @@ int ra_sd_tx_probe(struct ra_sd_tx *tx, struct device *dev)
 		return -ENODEV;
 	}
 
-	ret = ra_stream_table_tx_probe(dev, child_node, &tx->sttb);
+	ret = ra_stream_table_tx_probe(dev, child_node, &tx->sttb, adopt);
 	of_node_put(child_node);
 	if (ret < 0)
 		return ret;
@@ -350,13 +869,15 @@ int ra_sd_tx_probe(struct ra_sd_tx *tx, struct device *dev)
 		return -ENODEV;
 	}
 
-	ret = ra_track_table_probe(dev, child_node, &tx->trtb);
+	ret = ra_track_table_probe(dev, child_node, &tx->trtb, adopt);
 	of_node_put(child_node);
 	if (ret < 0)
 		return ret;
 
 	dev_info(dev, "RX track table, %d entries", tx->trtb.max_entries);
 
+	tx->sample_rate = RA_SD_TX_DEFAULT_SAMPLE_RATE;
+
 	xa_init_flags(&tx->streams, XA_FLAGS_ALLOC);
 	ret = devm_add_action_or_reset(dev, ra_sd_tx_destroy_streams,
 				       &tx->streams);
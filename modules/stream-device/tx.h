@@ -12,22 +12,63 @@ struct ra_sd_tx {
 	struct ra_track_table		trtb;
 	struct mutex			mutex;
 	struct xarray			streams;
+
+	/*
+	 * Admission control, protected by mutex. The arrays are indexed by
+	 * RA_SD_INTERFACE_..., and a budget of 0 means no limit.
+	 */
+	u32				sample_rate;
+	u64				budget_bps[2];
+	u64				used_bps[2];
 };
 
+#define RA_SD_TX_DEFAULT_SAMPLE_RATE	48000
+
 struct ra_sd_tx_stream_elem {
 	struct ra_sd_tx_stream	stream;
 	struct file		*filp;
 	struct pid		*pid;
 	int			trtb_index;
+
+	/* Handover token while detached, i.e. while filp is NULL */
+	u64			token;
 };
 
+struct ra_sd_tx_stream_elem *
+ra_sd_tx_stream_elem_find_by_index(struct ra_sd_tx *tx, int index);
+int ra_sd_tx_stream_ip_length(const struct ra_sd_tx_stream *stream);
+int ra_sd_tx_validate_stream(struct ra_sd_tx *tx,
+			     const struct ra_sd_tx_stream *stream);
+int ra_sd_tx_bandwidth_check(struct ra_sd_tx *tx, const u64 *used,
+			     const struct ra_sd_tx_stream *old,
+			     const struct ra_sd_tx_stream *new);
+void ra_sd_tx_bandwidth_update(struct ra_sd_tx *tx, u64 *used,
+			       const struct ra_sd_tx_stream *old,
+			       const struct ra_sd_tx_stream *new);
+int ra_sd_tx_set_bandwidth_config_ioctl(struct ra_sd_tx *tx, unsigned int size,
+					void __user *buf);
+int ra_sd_tx_read_bandwidth_ioctl(struct ra_sd_tx *tx, unsigned int size,
+				  void __user *buf);
+int ra_sd_tx_add_stream(struct ra_sd_tx *tx, struct file *filp,
+			const struct ra_sd_tx_stream *stream);
+int ra_sd_tx_update_stream(struct ra_sd_tx *tx, struct file *filp,
+			   u32 index, const struct ra_sd_tx_stream *stream);
+int ra_sd_tx_delete_stream(struct ra_sd_tx *tx, struct file *filp, u32 index);
+
 int ra_sd_tx_add_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 			      unsigned int size, void __user *buf);
 int ra_sd_tx_update_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 				 unsigned int size, void __user *buf);
 int ra_sd_tx_delete_stream_ioctl(struct ra_sd_tx *tx, struct file *filp,
 				 unsigned int size, void __user *buf);
+int ra_sd_tx_list_streams_ioctl(struct ra_sd_tx *tx, unsigned int size,
+				void __user *buf);
+int ra_sd_tx_defrag(struct ra_sd_tx *tx);
 int ra_sd_tx_delete_streams(struct ra_sd_tx *tx, struct file *filp);
-int ra_sd_tx_probe(struct ra_sd_tx *tx, struct device *dev);
+int ra_sd_tx_transfer_streams(struct ra_sd_tx *tx, struct file *from,
+			     u64 from_token, struct file *to, u64 to_token);
+int ra_sd_tx_adopt_streams(struct ra_sd_tx *tx);
+void ra_sd_tx_abandon_streams(struct ra_sd_tx *tx);
+int ra_sd_tx_probe(struct ra_sd_tx *tx, struct device *dev, bool adopt);
 
 #endif /* RA_SD_TX_H */